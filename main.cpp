@@ -31,9 +31,107 @@
 #include "pxr/usd/usdShade/material.h"
 #include "pxr/usd/usdShade/materialBindingAPI.h"
 
-
+//For the authoring tokens of the tutorials
+#include "pxr/base/tf/staticTokens.h"
+
+//For AttributeBatchReader
+#include "pxr/base/work/loops.h"
+#include "pxr/usd/usd/attributeQuery.h"
+
+//For AsyncLayerSaver
+#include "pxr/usd/sdf/layer.h"
+
+//For StageJobRunner
+#include "pxr/base/work/dispatcher.h"
+
+//For IncrementalLayerSaver
+#include "pxr/base/tf/notice.h"
+#include "pxr/base/tf/weakBase.h"
+#include "pxr/usd/sdf/notice.h"
+#include "pxr/usd/usd/usdFileFormat.h"
+
+//For SharedLayerCache
+#include "pxr/base/vt/dictionary.h"
+#include "pxr/usd/sdf/fileFormat.h"
+#include "pxr/usd/sdf/layerUtils.h"
+#include "pxr/usd/usdUtils/dependencies.h"
+
+//For PrimQuery
+#include "pxr/usd/kind/registry.h"
+#include "pxr/usd/usd/schemaRegistry.h"
+
+//For AsyncStageOpener
+#include "pxr/base/work/withScopedParallelism.h"
+
+//For SceneDeltaStream
+#include "pxr/usd/usd/notice.h"
+#include "pxr/usd/usdGeom/imageable.h"
+
+//For CompositionProfiler
+#include "pxr/base/tf/enum.h"
+#include "pxr/usd/pcp/iterator.h"
+#include "pxr/usd/pcp/layerStack.h"
+#include "pxr/usd/pcp/primIndex.h"
+
+//For SceneDiff
+#include "pxr/usd/sdf/primSpec.h"
+#include "pxr/usd/sdf/propertySpec.h"
+#include "pxr/usd/sdf/schema.h"
+#include "pxr/usd/sdf/types.h"
+#include "pxr/usd/sdf/variantSetSpec.h"
+#include "pxr/usd/sdf/variantSpec.h"
+
+//For TimeSampleCaptureLog
+#include "pxr/base/tf/fastCompression.h"
+#include "pxr/usd/sdf/attributeSpec.h"
+#include "pxr/usd/sdf/changeBlock.h"
+
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <malloc.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
 
 
 /*!
@@ -78,6 +176,118 @@ void TestFunction_PixarTutorial_HelloWorld()
 	stage->GetRootLayer()->Save(); // Save the stage at the same location as the application.
 }
 
+/*!
+@brief The tokens used by the authoring code of the tutorials, interned once.
+@details Constructing a TfToken from a string looks the string up in the global token
+		 registry every time, these are looked up only on the first use of the table.
+		 The macro names the Tf types unqualified, so it is expanded in a namespace of its own
+		 with a using directive, and only the table is brought to the file scope.
+*/
+namespace AuthoringTokens
+{
+PXR_NAMESPACE_USING_DIRECTIVE
+TF_DEFINE_PRIVATE_TOKENS(
+	_authoringTokens,
+	(comment)
+	(diffuseColor)
+	(extent)
+	(file)
+	((frameStPrimvarName, "frame:stPrimvarName"))
+	((materialBindingAPI, "MaterialBindingAPI"))
+	(metallic)
+	(offset)
+	(precess)
+	(radius)
+	(result)
+	(rgb)
+	(roughness)
+	(spin)
+	(st)
+	(surface)
+	(tilt)
+	((usdPreviewSurface, "UsdPreviewSurface"))
+	((usdPrimvarReaderFloat2, "UsdPrimvarReader_float2"))
+	((usdUVTexture, "UsdUVTexture"))
+	(varname)
+);
+}
+using AuthoringTokens::_authoringTokens;
+
+/*!
+@brief Reads the same attributes on many prims into typed contiguous buffers.
+@details The attribute names are turned into tokens and the value sources of every prim are
+		 resolved only once, when the reader is built, into a UsdAttributeQuery per prim and
+		 attribute. A read then only fetches the values, in parallel over the prims, into one
+		 buffer per attribute, along with a mask telling which prims have an authored value.
+		 Prims without authored value get the fallback value of the attribute if it has one,
+		 a default constructed value otherwise.
+		 The reader must be rebuilt once the stage has been recomposed.
+*/
+class AttributeBatchReader
+{
+public:
+	AttributeBatchReader(const std::vector<pxr::UsdPrim>& _prims, const std::vector<std::string>& _names)
+		: m_primCount(_prims.size())
+		, m_attributeCount(_names.size())
+	{
+		pxr::TfTokenVector names(_names.begin(), _names.end());
+		m_queries.resize(names.size() * m_primCount);
+		pxr::WorkParallelForN(m_primCount, [&](size_t _begin, size_t _end)
+		{
+			for (size_t prim = _begin; prim < _end; ++prim)
+			{
+				for (size_t attribute = 0; attribute < names.size(); ++attribute)
+				{
+					pxr::UsdAttribute attr = _prims[prim].GetAttribute(names[attribute]);
+					if (attr)
+					{
+						m_queries[attribute * m_primCount + prim] = pxr::UsdAttributeQuery(attr);
+					}
+				}
+			}
+		});
+	}
+
+	/*!
+	@brief Reads the attribute at index _attribute, in the order of the names given at construction, on all the prims.
+	@details _values and _authored are resized to the number of prims. T must be the value type of the
+			 attribute, e.g. double for "radius" or pxr::VtVec3fArray for "extent".
+	@return false if _attribute is not the index of one of the names, the buffers are then left empty.
+	*/
+	template <typename T>
+	bool Read(size_t _attribute, pxr::UsdTimeCode _time, std::vector<T>* _values, std::vector<unsigned char>* _authored) const
+	{
+		if (_attribute >= m_attributeCount)
+		{
+			_values->clear();
+			_authored->clear();
+			return false;
+		}
+		_values->assign(m_primCount, T());
+		_authored->assign(m_primCount, 0); // not a vector<bool>, so that the prims can be written concurrently
+
+		const pxr::UsdAttributeQuery* queries = m_queries.data() + _attribute * m_primCount;
+		pxr::WorkParallelForN(m_primCount, [&](size_t _begin, size_t _end)
+		{
+			for (size_t prim = _begin; prim < _end; ++prim)
+			{
+				if (!queries[prim].GetAttribute())
+				{
+					continue; // the prim has no such attribute
+				}
+				(*_authored)[prim] = queries[prim].HasAuthoredValue() ? 1 : 0;
+				queries[prim].Get(&(*_values)[prim], _time);
+			}
+		});
+		return true;
+	}
+
+private:
+	size_t m_primCount;
+	size_t m_attributeCount;
+	std::vector<pxr::UsdAttributeQuery> m_queries; //!< one row of prims per attribute
+};
+
 /*!
 @brief Function reproducing the third item of the Pixar USD tutorial.
 @see https://openusd.org/release/tut_inspect_and_author_props.html
@@ -149,17 +359,28 @@ void TestFunction_PixarTutorial_InspectAndAuthorProperties()
 	std::cout << "]" << std::endl;
 
 
-	pxr::UsdAttribute extentAttr = sphere.GetAttribute(pxr::TfToken("extent"));
-	pxr::VtVec3fArray extentValue;
-	extentAttr.Get(&extentValue);
+	// The values are read the way our QC tools read them on every gprim, in one batch.
+	AttributeBatchReader reader({ sphere }, { "extent", "radius", "primvars:displayColor" });
+	std::vector<pxr::VtVec3fArray> extents;
+	std::vector<double> radii;
+	std::vector<pxr::VtVec3fArray> displayColors;
+	std::vector<unsigned char> extentAuthored, radiusAuthored, displayColorAuthored;
+	reader.Read(0, pxr::UsdTimeCode::Default(), &extents, &extentAuthored);
+	reader.Read(1, pxr::UsdTimeCode::Default(), &radii, &radiusAuthored);
+	reader.Read(2, pxr::UsdTimeCode::Default(), &displayColors, &displayColorAuthored);
+
+	pxr::UsdAttribute extentAttr = sphere.GetAttribute(_authoringTokens->extent);
+	pxr::VtVec3fArray extentValue = extents[0];
 	std::cout << "extentAttr.Get(): (";
 	for (pxr::GfVec3f vec : extentValue)
 	{
 		std::cout << vec << ",";
 	}
-	std::cout << ")" << std::endl;
+	std::cout << ")" << (extentAuthored[0] ? "" : " (fallback)") << std::endl;
+	std::cout << "radiusAttr.Get(): " << radii[0] << (radiusAuthored[0] ? "" : " (fallback)") << std::endl;
+	std::cout << "displayColor authored: " << (displayColorAuthored[0] ? "True" : "False") << std::endl;
 
-	pxr::UsdAttribute radiusAttr = sphere.GetAttribute(pxr::TfToken("radius"));
+	pxr::UsdAttribute radiusAttr = sphere.GetAttribute(_authoringTokens->radius);
 	
 	std::cout << "Setting \"radius\" to 2.0 and multipliying ExtendedErrorParamTypes by 2."<< std::endl;
 	radiusAttr.Set(2.0);//must be a double
@@ -178,6 +399,372 @@ void TestFunction_PixarTutorial_InspectAndAuthorProperties()
 
 }
 
+/*!
+@brief A utility function to make sure a file that has just been written reached the disk.
+@return True if the operating system confirmed the flush.
+*/
+bool FlushFileToDisk(const std::string& _path)
+{
+#ifdef _WIN32
+	int fd = _open(_path.c_str(), _O_RDWR | _O_BINARY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool flushed = (_commit(fd) == 0);
+	_close(fd);
+#else
+	int fd = open(_path.c_str(), O_RDWR);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool flushed = (fsync(fd) == 0);
+	close(fd);
+#endif
+	return flushed;
+}
+
+/*!
+@brief Saves layers on a background thread while the authoring thread keeps going.
+@details Save() copies the content of the layer into an anonymous snapshot layer on the
+		 calling thread, which is cheap compared to the serialization. The worker thread then
+		 exports the snapshot to a temporary file next to the target, flushes it to the disk
+		 and renames it over the target.
+		 Saving the same layer again while its previous save is still queued only replaces the
+		 queued snapshot, and both calls share the same future.
+		 note: Sdf has no way to mark a layer as clean without saving it itself, so the saved
+		       layers stay dirty in memory.
+*/
+class AsyncLayerSaver
+{
+public:
+	AsyncLayerSaver()
+		: m_worker(&AsyncLayerSaver::Run, this)
+	{
+	}
+
+	~AsyncLayerSaver()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wakeUp.notify_all();
+		m_worker.join(); // the queue is drained before the worker stops
+	}
+
+	AsyncLayerSaver(const AsyncLayerSaver&) = delete;
+	AsyncLayerSaver& operator=(const AsyncLayerSaver&) = delete;
+
+	/*!
+	@brief Queues a snapshot of the layer for saving.
+	@return A future that becomes true once the file is on the disk, false if the save failed.
+	*/
+	std::shared_future<bool> Save(const pxr::SdfLayerHandle& _layer)
+	{
+		if (!_layer || _layer->IsAnonymous())
+		{
+			return MakeReadyFuture(false); // there is no file to save to
+		}
+		if (!_layer->IsDirty())
+		{
+			return MakeReadyFuture(true);
+		}
+
+		pxr::SdfLayerRefPtr snapshot = pxr::SdfLayer::CreateAnonymous("snapshot");
+		snapshot->TransferContent(_layer);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::string target = _layer->GetRealPath();
+		auto pending = m_pending.find(target);
+		if (pending != m_pending.end())
+		{
+			// The previous snapshot has not been written yet, the newer one supersedes it.
+			pending->second.snapshot = snapshot;
+			return pending->second.future;
+		}
+
+		PendingSave& save = m_pending[target];
+		save.snapshot = snapshot;
+		save.arguments = _layer->GetFileFormatArguments();
+		save.future = save.promise.get_future().share();
+		m_queue.push_back(target);
+		m_wakeUp.notify_one();
+		return save.future;
+	}
+
+	/*!
+	@brief Blocks until every queued save has been written.
+	@details Needed before anything reads one of the saved files from the disk again.
+	*/
+	void WaitForAll()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+	}
+
+private:
+	struct PendingSave
+	{
+		pxr::SdfLayerRefPtr snapshot;
+		pxr::SdfLayer::FileFormatArguments arguments;
+		std::promise<bool> promise;
+		std::shared_future<bool> future;
+	};
+
+	static std::shared_future<bool> MakeReadyFuture(bool _value)
+	{
+		std::promise<bool> promise;
+		promise.set_value(_value);
+		return promise.get_future().share();
+	}
+
+	static bool WriteSnapshot(const std::string& _target, const PendingSave& _save)
+	{
+		// The temporary file keeps the extension, it selects the file format of the export.
+		std::filesystem::path target(_target);
+		std::filesystem::path temporary = target.parent_path() /
+			("." + target.stem().string() + ".saving" + target.extension().string());
+
+		if (!_save.snapshot->Export(temporary.string(), std::string(), _save.arguments)
+			|| !FlushFileToDisk(temporary.string()))
+		{
+			std::error_code ignored;
+			std::filesystem::remove(temporary, ignored);
+			return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporary, target, error);
+		return !error;
+	}
+
+	void Run()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wakeUp.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+			if (m_queue.empty())
+			{
+				return; // stopping and nothing left to write
+			}
+
+			// Once taken out of the map, a new Save() of the same layer queues a new entry,
+			// which is written after this one.
+			std::string target = m_queue.front();
+			m_queue.pop_front();
+			auto pending = m_pending.find(target);
+			PendingSave save = std::move(pending->second);
+			m_pending.erase(pending);
+			m_writing = true;
+
+			lock.unlock();
+			bool saved = WriteSnapshot(target, save);
+			save.snapshot.Reset();
+			save.promise.set_value(saved);
+			lock.lock();
+
+			m_writing = false;
+			m_idle.notify_all();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeUp;
+	std::condition_variable m_idle;
+	std::map<std::string, PendingSave> m_pending;
+	std::deque<std::string> m_queue;
+	bool m_writing = false;
+	bool m_stop = false;
+	std::thread m_worker; // last member, it starts running in the constructor
+};
+
+/*!
+@brief Saves a layer only when it changed since its last save.
+@details Once a layer has been saved through the saver, or marked as saved by MarkSaved(),
+		 the saver records from SdfNotice::LayersDidChange the paths of its specs that are
+		 edited. A tracked layer with no recorded edits is skipped, even if Sdf still reports
+		 it as dirty. The notice is sent for all the layers of the process, the changes of the
+		 untracked layers are ignored and the layers that expired are forgotten. The notice may
+		 come from any thread, e.g. an AsyncLayerSaver worker, so the tracked layers are locked.
+		 A crate layer saved back to the file it was read from is not rewritten as a whole, the
+		 usdc writer appends the new and changed data to the existing file. These appended
+		 revisions accumulate, so every _compactionInterval incremental saves the crate is
+		 compacted: it is exported to a fresh file that replaces the old one and the layer is
+		 reloaded from it.
+*/
+class IncrementalLayerSaver : public pxr::TfWeakBase
+{
+public:
+	enum class SaveResult
+	{
+		Skipped,   //!< nothing changed since the last save
+		Saved,     //!< written, incrementally for crate layers
+		Compacted, //!< written and then rewritten as a compact crate file
+		Failed
+	};
+
+	explicit IncrementalLayerSaver(int _compactionInterval = 8)
+		: m_compactionInterval(_compactionInterval)
+	{
+		m_noticeKey = pxr::TfNotice::Register(pxr::TfCreateWeakPtr(this), &IncrementalLayerSaver::OnLayersDidChange);
+	}
+
+	~IncrementalLayerSaver()
+	{
+		pxr::TfNotice::Revoke(m_noticeKey);
+	}
+
+	/*!
+	@return The paths of the specs edited in the layer since it was last saved through this saver.
+	*/
+	std::set<pxr::SdfPath> GetChangedSpecs(const pxr::SdfLayerHandle& _layer) const
+	{
+		std::lock_guard<std::mutex> lock(m_layersMutex);
+		auto state = m_layers.find(_layer->GetIdentifier());
+		return state == m_layers.end() ? std::set<pxr::SdfPath>() : state->second.changedSpecs;
+	}
+
+	//! false if the layer is clean, or tracked and unchanged since its last save.
+	bool NeedsSave(const pxr::SdfLayerHandle& _layer) const
+	{
+		if (!_layer || !_layer->IsDirty())
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_layersMutex);
+		auto state = m_layers.find(_layer->GetIdentifier());
+		return state == m_layers.end() || !state->second.changedSpecs.empty();
+	}
+
+	//! Tracks the edits of a layer from now on, for a layer saved by other means, e.g. an AsyncLayerSaver.
+	void MarkSaved(const pxr::SdfLayerHandle& _layer)
+	{
+		std::lock_guard<std::mutex> lock(m_layersMutex);
+		LayerState& state = m_layers[_layer->GetIdentifier()];
+		state.layer = _layer;
+		state.changedSpecs.clear();
+	}
+
+	SaveResult Save(const pxr::SdfLayerHandle& _layer)
+	{
+		if (!_layer || _layer->IsAnonymous())
+		{
+			return SaveResult::Failed;
+		}
+		if (!NeedsSave(_layer))
+		{
+			return SaveResult::Skipped;
+		}
+
+		if (!_layer->Save())
+		{
+			return SaveResult::Failed;
+		}
+		MarkSaved(_layer);
+		if (!IsCrate(_layer))
+		{
+			return SaveResult::Saved;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_layersMutex);
+			LayerState& state = m_layers[_layer->GetIdentifier()];
+			if (++state.incrementalSaves < m_compactionInterval)
+			{
+				return SaveResult::Saved;
+			}
+			state.incrementalSaves = 0;
+		}
+		bool compacted = Compact(_layer);
+		// the reload reports every spec of the layer as changed, none of them was edited
+		MarkSaved(_layer);
+		return compacted ? SaveResult::Compacted : SaveResult::Saved;
+	}
+
+	static const char* ToString(SaveResult _result)
+	{
+		switch (_result)
+		{
+		case SaveResult::Skipped: return "skipped, unchanged";
+		case SaveResult::Saved: return "saved";
+		case SaveResult::Compacted: return "saved and compacted";
+		default: return "FAILED";
+		}
+	}
+
+private:
+	struct LayerState
+	{
+		pxr::SdfLayerHandle layer;
+		std::set<pxr::SdfPath> changedSpecs;
+		int incrementalSaves = 0;
+	};
+
+	void OnLayersDidChange(const pxr::SdfNotice::LayersDidChange& _notice)
+	{
+		std::lock_guard<std::mutex> lock(m_layersMutex);
+		for (auto state = m_layers.begin(); state != m_layers.end();)
+		{
+			state = state->second.layer ? std::next(state) : m_layers.erase(state);
+		}
+		for (const auto& layerAndChanges : _notice.GetChangeListVec())
+		{
+			auto state = layerAndChanges.first ? m_layers.find(layerAndChanges.first->GetIdentifier()) : m_layers.end();
+			if (state == m_layers.end())
+			{
+				continue;
+			}
+			for (const auto& entry : layerAndChanges.second.GetEntryList())
+			{
+				state->second.changedSpecs.insert(entry.first);
+			}
+		}
+	}
+
+	static bool IsCrate(const pxr::SdfLayerHandle& _layer)
+	{
+		// .usd files may be text or crate, the usd file format tells which one.
+		static const pxr::TfToken usdc("usdc");
+		pxr::SdfFileFormatConstPtr format = _layer->GetFileFormat();
+		if (format->GetFormatId() == usdc)
+		{
+			return true;
+		}
+		return format->GetFormatId() == pxr::UsdUsdFileFormatTokens->Id
+			&& pxr::UsdUsdFileFormat::GetUnderlyingFormatForLayer(*_layer) == usdc;
+	}
+
+	static bool Compact(const pxr::SdfLayerHandle& _layer)
+	{
+		std::filesystem::path target(_layer->GetRealPath());
+		std::filesystem::path compacted = target.parent_path() /
+			("." + target.stem().string() + ".compacting" + target.extension().string());
+
+		std::error_code error;
+		if (!_layer->Export(compacted.string(), std::string(), _layer->GetFileFormatArguments()))
+		{
+			std::filesystem::remove(compacted, error);
+			return false;
+		}
+		std::filesystem::rename(compacted, target, error);
+		if (error)
+		{
+			// e.g. Windows does not replace a file the crate reader still has mapped
+			std::filesystem::remove(compacted, error);
+			return false;
+		}
+		// The layer is clean at this point, reloading it only swaps the file it reads from.
+		return _layer->Reload(true);
+	}
+
+	int m_compactionInterval;
+	mutable std::mutex m_layersMutex;
+	std::map<std::string, LayerState> m_layers;
+	pxr::TfNotice::Key m_noticeKey;
+};
+
 /*!
 @brief Function reproducing the fourth item of the Pixar USD tutorial
 @see https://openusd.org/release/tut_referencing_layers.html
@@ -186,6 +773,11 @@ void TestFunction_PixarTutorial_ReferencingLayers()
 {
 	std::cout << "** TestFunction_ReferencingLayers **" << std::endl;
 
+	// The saves of the tutorial steps are written in the background while the next steps are authored,
+	// and the layers that did not change since their last save are not written again.
+	AsyncLayerSaver saver;
+	IncrementalLayerSaver changes;
+
 	// -- Step 1
 	std::cout << "---- Step 1 ----" << std::endl;
 
@@ -210,6 +802,9 @@ void TestFunction_PixarTutorial_ReferencingLayers()
 	stage->GetRootLayer()->ExportToString(&fileResult);
 	std::cout << "Content of file HelloWorld.usda:\n" << fileResult << std::endl;
 
+	saver.Save(stage->GetRootLayer());
+	changes.MarkSaved(stage->GetRootLayer());
+
 	// -- Step 2
 	std::cout << "---- Step 2 ----" << std::endl;
 
@@ -241,6 +836,9 @@ void TestFunction_PixarTutorial_ReferencingLayers()
 	refStage->GetRootLayer()->ExportToString(&fileResult);
 	std::cout << "Content of file RefExample.usda after referencing HelloWorld.usda:\n" << fileResult << std::endl;
 
+	saver.Save(refStage->GetRootLayer());
+	changes.MarkSaved(refStage->GetRootLayer());
+
 	// -- Step 4
 	std::cout << "---- Step 4 ----" << std::endl;
 
@@ -274,6 +872,9 @@ void TestFunction_PixarTutorial_ReferencingLayers()
 	refStage->GetRootLayer()->ExportToString(&fileResult);
 	std::cout << "Content of file RefExample.usda after adding a second reference to HelloWorld.usda:\n" << fileResult << std::endl;
 
+	saver.Save(refStage->GetRootLayer());
+	changes.MarkSaved(refStage->GetRootLayer());
+
 	// -- Step 6
 	std::cout << "---- Step 6 ----" << std::endl;
 
@@ -291,734 +892,4752 @@ void TestFunction_PixarTutorial_ReferencingLayers()
 	refStage->GetRootLayer()->ExportToString(&fileResult);
 	std::cout << "Content of file RefExample.usda after setting the display color of /refSphere2/world to red:\n" << fileResult << std::endl;
 
-	stage->GetRootLayer()->Save();
-	refStage->GetRootLayer()->Save();
+	// note: a save of RefExample.usda still queued from the previous steps is replaced by this one.
+	//		 HelloWorld.usda has not been edited since step 1, it is skipped.
+	for (const pxr::SdfLayerHandle& layer : { refStage->GetRootLayer(), stage->GetRootLayer() })
+	{
+		if (!changes.NeedsSave(layer))
+		{
+			std::cout << layer->GetDisplayName() << " skipped, unchanged since its last save" << std::endl;
+			continue;
+		}
+		std::shared_future<bool> saved = saver.Save(layer);
+		changes.MarkSaved(layer);
+		std::cout << layer->GetDisplayName() << " saved: " << (saved.get() ? "True" : "False") << std::endl;
+	}
 }
 
 /*!
-@brief Function reproducing the sixth item of the Pixar USD tutorial
-@see https://openusd.org/release/tut_traversing_stage.html
+@brief Indexes the prims of a stage by type name and kind, for PrimQuery.
+@details The index is a snapshot, it has to be rebuilt after the stage changed.
 */
-void TestFunction_PixarTutorial_StageTraversal()
+class PrimQueryIndex
 {
-	// This step of the tutorial originally uses usdview and the python interpreter.
-	// I will adapt the demonstrated commands to C++ code.
-
-	std::cout << "** TestFunction_PixarTutorial_StageTraversal **" << std::endl;
-
-	// -- Step 1
-	std::cout << "---- Step 1 ----" << std::endl;
+public:
+	explicit PrimQueryIndex(const pxr::UsdStageRefPtr& _stage)
+	{
+		for (pxr::UsdPrim prim : _stage->TraverseAll())
+		{
+			m_byType[prim.GetTypeName()].push_back(prim.GetPath());
 
-	/*! The Python commands in the interpreter
-		[x for x in usdviewApi.stage.Traverse()]
-		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2>), Usd.Prim(</refSphere2/world>)]
-	*/
+			pxr::TfToken kind;
+			if (pxr::UsdModelAPI(prim).GetKind(&kind) && !kind.IsEmpty())
+			{
+				m_byKind[kind].push_back(prim.GetPath());
+			}
+		}
+	}
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdStageRefPtr refStage = pxr::UsdStage::Open("RefExample.usda");
-	pxr::UsdPrimRange allPrims = refStage->Traverse();
-	std::cout << "All prims in the stage of RefExample.usda:" << std::endl;
-	for (pxr::UsdPrim prim : allPrims)
+	//! The paths of the prims whose type is or derives from _type, sorted.
+	pxr::SdfPathVector FindByType(const pxr::TfType& _type) const
 	{
-		std::cout << prim.GetPath() << std::endl;
+		pxr::SdfPathVector paths;
+		for (const auto& typeAndPaths : m_byType)
+		{
+			pxr::TfType type = pxr::UsdSchemaRegistry::GetTypeFromName(typeAndPaths.first);
+			if (!type.IsUnknown() && type.IsA(_type))
+			{
+				paths.insert(paths.end(), typeAndPaths.second.begin(), typeAndPaths.second.end());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+		return paths;
 	}
 
-	// -- Step 2
-	std::cout << "---- Step 2 ----" << std::endl;
+	//! The paths of the prims whose kind is or derives from _kind, sorted.
+	pxr::SdfPathVector FindByKind(const pxr::TfToken& _kind) const
+	{
+		pxr::SdfPathVector paths;
+		for (const auto& kindAndPaths : m_byKind)
+		{
+			if (pxr::KindRegistry::IsA(kindAndPaths.first, _kind))
+			{
+				paths.insert(paths.end(), kindAndPaths.second.begin(), kindAndPaths.second.end());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+		return paths;
+	}
 
-	/*! The Python commands in the interpreter
-		[x for x in usdviewApi.stage.Traverse() if UsdGeom.Sphere(x)]
-		# Output: [Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2/world>)]
-	*/
+private:
+	std::map<pxr::TfToken, pxr::SdfPathVector> m_byType;
+	std::map<pxr::TfToken, pxr::SdfPathVector> m_byKind;
+};
 
-	// Write the C++ equivalent of the python code above
-	std::vector<pxr::UsdGeomSphere> allSpheres;
-	for (auto it = allPrims.begin(); it != allPrims.end(); ++it)
+/*!
+@brief A small query language for the prims of a stage, replacing hand written filters over Traverse().
+@details A query is a list of terms separated by spaces, a prim is returned if it matches all of them:
+		 type:<schema>    the prim is a Sphere, Xform, UsdGeomGprim, ...
+		 kind:<kind>      the kind of the model is or derives from <kind>
+		 under:<pattern>  the prim is at or below a path matching <pattern>, '*' matches within a name
+		 active:<bool>    the prim is active or not, inactive prims are only visited with this term
+		 has:<property>   the prim has the property, e.g. has:primvars:displayColor
+		 The query is compiled once into a plan:
+		 - the literal leading names of the under: pattern give the roots of the traversal, and the
+		   subtrees whose names do not match the rest of the pattern are pruned,
+		 - with a model kind, the subtrees below non-model prims and below components are pruned,
+		   since the model hierarchy must be contiguous from the root,
+		 - the subtrees of the roots are traversed in parallel.
+		 Given a PrimQueryIndex, the type: and kind: terms are answered from the index instead
+		 of a traversal, and the results are in path order.
+@see StageTraversal
+*/
+class PrimQuery
+{
+public:
+	explicit PrimQuery(const std::string& _query)
 	{
-		if ((*it).IsA<pxr::UsdGeomSphere>())
+		std::istringstream terms(_query);
+		std::string term;
+		while (terms >> term && m_error.empty())
 		{
-			allSpheres.push_back(pxr::UsdGeomSphere(*it));
+			CompileTerm(term);
 		}
+		// an active: term only lifts the active flag of the default predicate, classes and undefined overs stay out
+		m_predicate = m_active < 0 ? pxr::Usd_PrimFlagsPredicate(pxr::UsdPrimDefaultPredicate)
+			: pxr::Usd_PrimFlagsPredicate(pxr::UsdPrimIsLoaded && pxr::UsdPrimIsDefined && !pxr::UsdPrimIsAbstract);
 	}
 
-	std::cout << "All prims in the stage of RefExample.usda that are UsdGeomSpheres:\n" << std::endl;
-	for (pxr::UsdGeomSphere sphere : allSpheres)
+	bool IsValid() const
 	{
-		std::cout << sphere.GetPath() << std::endl;
+		return m_error.empty();
 	}
-	
-
-	// -- Step 3
-	std::cout << "---- Step 3 ----" << std::endl;
-
-	/*! The Python commands in the interpreter
-		
-		primIter = iter(Usd.PrimRange.PreAndPostVisit(usdviewApi.stage.GetPseudoRoot()))
-		for x in primIter: print(x, primIter.IsPostVisit())
-
-		# Output:
-		Usd.Prim(</>) False
-		Usd.Prim(</refSphere>) False
-		Usd.Prim(</refSphere/world>) False
-		Usd.Prim(</refSphere/world>) True
-		Usd.Prim(</refSphere>) True
-		Usd.Prim(</refSphere2>) False
-		Usd.Prim(</refSphere2/world>) False
-		Usd.Prim(</refSphere2/world>) True
-		Usd.Prim(</refSphere2>) True
-		Usd.Prim(</>) True
-	*/
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdPrimRange pseudoRoot = pxr::UsdPrimRange::PreAndPostVisit(refStage->GetPseudoRoot());
-	std::cout << "All prims in the stage of RefExample.usda with pre and post visit:\n" << std::endl;
-	for (auto it = pseudoRoot.begin(); it != pseudoRoot.end(); ++it)
+	const std::string& GetError() const
 	{
-		std::cout << (*it).GetPath() << " " << (it.IsPostVisit() ? "True" : "False") << std::endl;
+		return m_error;
 	}
 
-	// -- Step 4
-	std::cout << "---- Step 4 ----" << std::endl;
+	std::vector<pxr::UsdPrim> Run(const pxr::UsdStageRefPtr& _stage, const PrimQueryIndex* _index = nullptr) const
+	{
+		if (!IsValid())
+		{
+			return {};
+		}
+		if (_index && (!m_type.IsUnknown() || !m_kind.IsEmpty()))
+		{
+			return RunOnIndex(_stage, *_index);
+		}
 
-	/*! The Python commands in the interpreter
-		
-		# First, manually inactivate the reference to refSphere2
+		// Follow the literal names at the beginning of the under: pattern.
+		std::vector<pxr::UsdPrim> frontier{ _stage->GetPseudoRoot() };
+		size_t depth = 0;
+		for (; depth < m_under.size() && m_under[depth].find('*') == std::string::npos; ++depth)
+		{
+			std::vector<pxr::UsdPrim> next;
+			for (const pxr::UsdPrim& prim : frontier)
+			{
+				for (const pxr::UsdPrim& child : prim.GetFilteredChildren(m_predicate))
+				{
+					if (child.GetName() == m_under[depth])
+					{
+						next.push_back(child);
+					}
+				}
+			}
+			frontier.swap(next);
+		}
 
-		# Then Print the prims in the stage
-		[x for x in usdviewApi.stage.Traverse()]
-		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>)]
+		std::vector<pxr::UsdPrim> results;
+		std::vector<pxr::UsdPrim> roots;
+		for (const pxr::UsdPrim& prim : frontier)
+		{
+			if (depth > 0 && depth >= m_under.size() && MatchesTerms(prim))
+			{
+				results.push_back(prim);
+			}
+			if (depth == 0 || !PrunesBelow(prim))
+			{
+				for (const pxr::UsdPrim& child : prim.GetFilteredChildren(m_predicate))
+				{
+					roots.push_back(child);
+				}
+			}
+		}
 
-		[x for x in usdviewApi.stage.TraverseAll()]
-		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2>)]
-	*/
+		std::vector<std::vector<pxr::UsdPrim>> subtreeResults(roots.size());
+		pxr::WorkParallelForN(roots.size(), [&](size_t _begin, size_t _end)
+		{
+			for (size_t i = _begin; i < _end; ++i)
+			{
+				VisitSubtree(roots[i], subtreeResults[i]);
+			}
+		});
+		for (const std::vector<pxr::UsdPrim>& subtree : subtreeResults)
+		{
+			results.insert(results.end(), subtree.begin(), subtree.end());
+		}
+		return results;
+	}
 
-	// Write the C++ equivalent of the python code above
-	refStage->OverridePrim(pxr::SdfPath("/refSphere2")).SetActive(false);
+private:
+	void CompileTerm(const std::string& _term)
+	{
+		size_t colon = _term.find(':');
+		if (colon == std::string::npos || colon + 1 == _term.size())
+		{
+			m_error = "expected key:value, got \"" + _term + "\"";
+			return;
+		}
+		std::string key = _term.substr(0, colon);
+		std::string value = _term.substr(colon + 1);
 
-	//print the stage to check that it's marked as inactive
-	std::string fileResult;
-	refStage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file RefExample.usda after deactivating refSphere2:\n" << fileResult << std::endl;
+		if (key == "type")
+		{
+			m_type = pxr::UsdSchemaRegistry::GetTypeFromName(pxr::TfToken(value));
+			if (m_type.IsUnknown())
+			{
+				m_type = pxr::TfType::FindByName(value);
+			}
+			if (m_type.IsUnknown())
+			{
+				m_error = "unknown schema type \"" + value + "\"";
+			}
+		}
+		else if (key == "kind")
+		{
+			m_kind = pxr::TfToken(value);
+			if (!pxr::KindRegistry::HasKind(m_kind))
+			{
+				m_error = "unknown kind \"" + value + "\"";
+			}
+			m_kindIsModel = pxr::KindRegistry::IsA(m_kind, pxr::KindTokens->model);
+			m_kindIsComponent = pxr::KindRegistry::IsA(m_kind, pxr::KindTokens->component);
+		}
+		else if (key == "under")
+		{
+			if (value[0] != '/')
+			{
+				m_error = "under: expects an absolute path pattern, got \"" + value + "\"";
+				return;
+			}
+			std::istringstream names(value.substr(1));
+			std::string name;
+			while (std::getline(names, name, '/'))
+			{
+				m_under.push_back(name);
+			}
+		}
+		else if (key == "active")
+		{
+			if (value != "true" && value != "false")
+			{
+				m_error = "active: expects true or false, got \"" + value + "\"";
+			}
+			m_active = (value == "true") ? 1 : 0;
+		}
+		else if (key == "has")
+		{
+			m_properties.push_back(pxr::TfToken(value));
+		}
+		else
+		{
+			m_error = "unknown term \"" + key + "\"";
+		}
+	}
 
-	//Accoding to documentation: "refStage->Traverse(): Traverse the active, loaded, defined, non-abstract prims on this stage depth-first."
-	std::cout << "Prims (active, loaded, defined, non-abstract) in the stage of RefExample.usda after deactivating refSphere2:" << std::endl;
-	for (pxr::UsdPrim prim : refStage->Traverse())
+	//! Matches a name against a pattern in which '*' stands for any sequence of characters.
+	static bool MatchesName(const std::string& _name, const std::string& _pattern)
 	{
-		std::cout << prim.GetPath() << std::endl;
+		size_t n = 0, p = 0, star = std::string::npos, resume = 0;
+		while (n < _name.size())
+		{
+			if (p < _pattern.size() && _pattern[p] == '*')
+			{
+				star = p++;
+				resume = n;
+			}
+			else if (p < _pattern.size() && _pattern[p] == _name[n])
+			{
+				++p;
+				++n;
+			}
+			else if (star != std::string::npos)
+			{
+				p = star + 1;
+				n = ++resume;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		while (p < _pattern.size() && _pattern[p] == '*')
+		{
+			++p;
+		}
+		return p == _pattern.size();
 	}
 
-	std::cout << std::endl; //just for layout of the ouput
+	//! All the terms but under:, which is handled by the traversal.
+	bool MatchesTerms(const pxr::UsdPrim& _prim) const
+	{
+		if (m_active >= 0 && _prim.IsActive() != (m_active == 1))
+		{
+			return false;
+		}
+		if (!m_type.IsUnknown() && !_prim.IsA(m_type))
+		{
+			return false;
+		}
+		if (!m_kind.IsEmpty())
+		{
+			pxr::TfToken kind;
+			if (!pxr::UsdModelAPI(_prim).GetKind(&kind) || !pxr::KindRegistry::IsA(kind, m_kind))
+			{
+				return false;
+			}
+		}
+		for (const pxr::TfToken& property : m_properties)
+		{
+			if (!_prim.HasProperty(property))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
 
-	//According to documentation "refStage->TraverseAll(): Traverse all the prims on this stage depth-first."
-	std::cout << "All Prims in the stage of RefExample.usda after deactivating refSphere2:" << std::endl;
-	for (pxr::UsdPrim prim : refStage->TraverseAll())
+	//! True if no descendant of the prim can match the kind: term.
+	bool PrunesBelow(const pxr::UsdPrim& _prim) const
 	{
-		std::cout << prim.GetPath() << std::endl;
+		return (m_kindIsModel && !_prim.IsModel()) || (m_kindIsComponent && _prim.IsComponent());
+	}
+
+	void VisitSubtree(const pxr::UsdPrim& _root, std::vector<pxr::UsdPrim>& _results) const
+	{
+		pxr::UsdPrimRange range(_root, m_predicate);
+		for (auto it = range.begin(); it != range.end(); ++it)
+		{
+			pxr::UsdPrim prim = *it;
+
+			// The ancestors have already been matched against the pattern, only the name is left.
+			size_t depth = prim.GetPath().GetPathElementCount();
+			if (depth <= m_under.size() && !MatchesName(prim.GetName().GetString(), m_under[depth - 1]))
+			{
+				it.PruneChildren();
+				continue;
+			}
+			if (depth >= m_under.size() && MatchesTerms(prim))
+			{
+				_results.push_back(prim);
+			}
+			if (PrunesBelow(prim))
+			{
+				it.PruneChildren();
+			}
+		}
+	}
+
+	std::vector<pxr::UsdPrim> RunOnIndex(const pxr::UsdStageRefPtr& _stage, const PrimQueryIndex& _index) const
+	{
+		pxr::SdfPathVector candidates;
+		if (!m_type.IsUnknown())
+		{
+			candidates = _index.FindByType(m_type);
+		}
+		if (!m_kind.IsEmpty())
+		{
+			pxr::SdfPathVector byKind = _index.FindByKind(m_kind);
+			if (m_type.IsUnknown())
+			{
+				candidates.swap(byKind);
+			}
+			else
+			{
+				pxr::SdfPathVector both;
+				std::set_intersection(candidates.begin(), candidates.end(), byKind.begin(), byKind.end(), std::back_inserter(both));
+				candidates.swap(both);
+			}
+		}
+
+		std::vector<pxr::UsdPrim> prims(candidates.size());
+		pxr::WorkParallelForN(candidates.size(), [&](size_t _begin, size_t _end)
+		{
+			for (size_t i = _begin; i < _end; ++i)
+			{
+				pxr::UsdPrim prim = _stage->GetPrimAtPath(candidates[i]);
+				if (prim && m_predicate(prim) && MatchesUnder(candidates[i]) && MatchesTerms(prim))
+				{
+					prims[i] = prim;
+				}
+			}
+		});
+		prims.erase(std::remove_if(prims.begin(), prims.end(), [](const pxr::UsdPrim& _prim) { return !_prim; }), prims.end());
+		return prims;
+	}
+
+	bool MatchesUnder(const pxr::SdfPath& _path) const
+	{
+		pxr::SdfPathVector prefixes = _path.GetPrefixes();
+		if (prefixes.size() < m_under.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < m_under.size(); ++i)
+		{
+			if (!MatchesName(prefixes[i].GetName(), m_under[i]))
+			{
+				return false;
+			}
+		}
+		return true;
 	}
-}
+
+	pxr::TfType m_type;
+	pxr::TfToken m_kind;
+	bool m_kindIsModel = false;
+	bool m_kindIsComponent = false;
+	std::vector<std::string> m_under;
+	int m_active = -1; //!< -1 when there is no active: term
+	pxr::TfTokenVector m_properties;
+	pxr::Usd_PrimFlagsPredicate m_predicate = pxr::UsdPrimDefaultPredicate;
+	std::string m_error;
+};
 
 /*!
-@brief Function reproducing the Pixar USD tutorial on authoring variants
-@see https://openusd.org/release/tut_authoring_variants.html
+@brief Turns the change notices of a stage into batches of typed events, so that a consumer
+	   can follow the edits of the stage instead of traversing it again after each of them.
+@details The notices are gathered until Flush(), which coalesces them into one batch:
+		 - the events below a prim that is added, removed or resynced are dropped, as the
+		   consumer reads that whole subtree again,
+		 - a resync of a prim whose active state changed is reported as ActiveToggled,
+		 - an attribute edited several times is reported once, an edit of visibility is
+		   reported as VisibilityToggled on the prim, since it is inherited by the subtree,
+		 - edits of other prim metadata are not reported.
+		 The batches are numbered from 1, a subscriber which sees a gap in the sequence must
+		 read the stage again. All prims are followed, including the inactive ones.
+@see SceneMirror
 */
-void TestFunction_PixarTutorial_AuthoringVariants()
+class SceneDeltaStream : public pxr::TfWeakBase
 {
-	std::cout << "** TestFunction_PixarTutorial_AuthoringVariants **" << std::endl;
+public:
+	enum class EventType { PrimAdded, PrimRemoved, PrimResynced, ActiveToggled, VisibilityToggled, AttributeChanged };
 
-// -- Step 1
-	std::cout << "---- Step 1 ----" << std::endl;
+	struct Event
+	{
+		EventType type;
+		pxr::SdfPath path; //!< the attribute path for AttributeChanged, the prim path otherwise
+	};
 
-	/*! Python code from the tutorial
-		from pxr import Usd, UsdGeom
-		stage = Usd.Stage.Open('HelloWorld.usda')
-		colorAttr = UsdGeom.Gprim.Get(stage, '/hello/world').GetDisplayColorAttr()
-		colorAttr.Clear()
-		print(stage.GetRootLayer().ExportToString())
-	*/
+	struct Batch
+	{
+		uint64_t sequence = 0;
+		std::vector<Event> events;
+	};
 
-	// Write the C++ equivalent of the python code above
+	using Subscriber = std::function<void(const Batch&)>;
 
-	//note: Local "opinions" in prims are stronger than variant selections.
-	//		Therefore, the color of /hello/world is going to be cleared before adding 
-	//		variants to a variant set.
-	pxr::UsdStageRefPtr stage = pxr::UsdStage::Open("HelloWorld.usda");
-	pxr::UsdGeomGprim gprim = pxr::UsdGeomGprim::Get(stage, pxr::SdfPath("/hello/world"));
-	pxr::UsdAttribute colorAttr = gprim.GetDisplayColorAttr();
-	colorAttr.Clear();
-	
-	std::string fileResult;
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file HelloWorld.usda after clearing the display color of /hello/world:\n" << fileResult << std::endl;
+	explicit SceneDeltaStream(const pxr::UsdStageRefPtr& _stage)
+		: m_stage(_stage)
+	{
+		AddSubtree(m_stage->GetPseudoRoot());
+		m_noticeKey = pxr::TfNotice::Register(pxr::TfCreateWeakPtr(this), &SceneDeltaStream::OnObjectsChanged,
+			pxr::UsdStageWeakPtr(m_stage));
+	}
 
-	// -- Step 2
-	std::cout << "---- Step 2 ----" << std::endl;
+	~SceneDeltaStream()
+	{
+		pxr::TfNotice::Revoke(m_noticeKey);
+	}
 
-	/*!Python code from the tutorial
-		rootPrim = stage.GetPrimAtPath('/hello')
-		vset = rootPrim.GetVariantSets().AddVariantSet('shadingVariant')
-		print(stage.GetRootLayer().ExportToString())
-	*/
-	
-	// Write the C++ equivalent of the python code above
-	pxr::UsdPrim rootPrim = stage->GetPrimAtPath(pxr::SdfPath("/hello"));
-	pxr::UsdVariantSet vset = rootPrim.GetVariantSets().AddVariantSet("shadingVariant");
+	SceneDeltaStream(const SceneDeltaStream&) = delete;
+	SceneDeltaStream& operator=(const SceneDeltaStream&) = delete;
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file HelloWorld.usda after adding a variant set to /hello:\n" << fileResult << std::endl;
+	void Subscribe(Subscriber _subscriber)
+	{
+		m_subscribers.push_back(std::move(_subscriber));
+	}
 
-	// -- Step 3
-	std::cout << "---- Step 3 ----" << std::endl;
+	//! The sequence number of the last batch, 0 before the first one.
+	uint64_t GetSequence() const
+	{
+		return m_sequence;
+	}
 
-	/*! Python code from the tutorial
-		vset.AddVariant('red')
-		vset.AddVariant('blue')
-		vset.AddVariant('green')
-		print(stage.GetRootLayer().ExportToString())
+	/*!
+	@brief Sends the changes since the last flush to the subscribers, as one batch.
+	@return The sequence number of the batch, or 0 when nothing changed.
 	*/
+	uint64_t Flush()
+	{
+		if (m_resyncs.empty() && m_attributes.empty())
+		{
+			return 0;
+		}
 
-	// Write the C++ equivalent of the python code above
-	vset.AddVariant("red");
-	vset.AddVariant("blue");
-	vset.AddVariant("green");
-	
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file HelloWorld.usda after adding variants to the variant set of /hello:\n" << fileResult << std::endl;
+		Batch batch;
+		std::vector<pxr::SdfPath> resyncedPrims;
+		for (const pxr::SdfPath& path : m_resyncs)
+		{
+			if (path.IsPrimPropertyPath())
+			{
+				m_attributes.insert(path); // an attribute added or removed
+			}
+			else if (!HasResyncedAncestor(path))
+			{
+				resyncedPrims.push_back(path);
+			}
+		}
 
-	// -- Step 4 & 5
-	std::cout << "---- Step 4 & 5 ----" << std::endl;
+		for (const pxr::SdfPath& path : resyncedPrims)
+		{
+			auto known = m_known.find(path);
+			pxr::UsdPrim prim = m_stage->GetPrimAtPath(path);
+			if (known == m_known.end())
+			{
+				if (prim)
+				{
+					batch.events.push_back({ EventType::PrimAdded, path });
+				}
+			}
+			else if (!prim)
+			{
+				batch.events.push_back({ EventType::PrimRemoved, path });
+			}
+			else
+			{
+				EventType type = known->second != prim.IsActive() ? EventType::ActiveToggled : EventType::PrimResynced;
+				batch.events.push_back({ type, path });
+			}
+
+			m_known.erase(m_known.lower_bound(path), EndOfSubtree(path));
+			if (prim)
+			{
+				AddSubtree(prim);
+			}
+		}
 
-	/*!
-		vset.SetVariantSelection('red')
-		with vset.GetVariantEditContext():
-			colorAttr.Set([(1,0,0)])
+		std::set<pxr::SdfPath> toggled;
+		for (const pxr::SdfPath& path : m_attributes)
+		{
+			pxr::SdfPath primPath = path.GetPrimPath();
+			if (HasResyncedAncestor(primPath) || m_resyncs.count(primPath))
+			{
+				continue;
+			}
+			if (path.GetNameToken() != pxr::UsdGeomTokens->visibility)
+			{
+				batch.events.push_back({ EventType::AttributeChanged, path });
+			}
+			else if (toggled.insert(primPath).second)
+			{
+				batch.events.push_back({ EventType::VisibilityToggled, primPath });
+			}
+		}
 
-		vset.SetVariantSelection('blue')
-		with vset.GetVariantEditContext():
-			colorAttr.Set([(0,0,1)])
+		m_resyncs.clear();
+		m_attributes.clear();
+		if (batch.events.empty())
+		{
+			return 0;
+		}
 
-		vset.SetVariantSelection('green')
-		with vset.GetVariantEditContext():
-			colorAttr.Set([(0,1,0)])
+		batch.sequence = ++m_sequence;
+		for (const Subscriber& subscriber : m_subscribers)
+		{
+			subscriber(batch);
+		}
+		return batch.sequence;
+	}
 
-		print(stage.GetRootLayer().ExportToString())
-	*/
+	static const char* ToString(EventType _type)
+	{
+		switch (_type)
+		{
+		case EventType::PrimAdded: return "prim added";
+		case EventType::PrimRemoved: return "prim removed";
+		case EventType::PrimResynced: return "prim resynced";
+		case EventType::ActiveToggled: return "active toggled";
+		case EventType::VisibilityToggled: return "visibility toggled";
+		default: return "attribute changed";
+		}
+	}
 
-	// Write the C++ equivalent of the python code above
-	vset.SetVariantSelection("red");
+private:
+	void OnObjectsChanged(const pxr::UsdNotice::ObjectsChanged& _notice, const pxr::UsdStageWeakPtr&)
 	{
-		pxr::UsdEditContext context(vset.GetVariantEditContext());
-		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(1, 0, 0) }));
+		for (const pxr::SdfPath& path : _notice.GetResyncedPaths())
+		{
+			m_resyncs.insert(path);
+		}
+		for (const pxr::SdfPath& path : _notice.GetChangedInfoOnlyPaths())
+		{
+			if (path.IsPrimPropertyPath())
+			{
+				m_attributes.insert(path);
+			}
+		}
 	}
 
-	vset.SetVariantSelection("blue");
+	bool HasResyncedAncestor(const pxr::SdfPath& _path) const
 	{
-		pxr::UsdEditContext context(vset.GetVariantEditContext());
-		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) }));
+		for (pxr::SdfPath parent = _path.GetParentPath(); !parent.IsEmpty(); parent = parent.GetParentPath())
+		{
+			if (m_resyncs.count(parent))
+			{
+				return true;
+			}
+		}
+		return false;
 	}
 
-	vset.SetVariantSelection("green");//note: this is going to stay as the default selected variant in helloWorld.usda
+	//! The prims of a subtree are contiguous in path order, just after the root of the subtree.
+	std::map<pxr::SdfPath, bool>::iterator EndOfSubtree(const pxr::SdfPath& _root)
 	{
-		pxr::UsdEditContext context(vset.GetVariantEditContext());
-		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 1, 0) }));
+		auto it = m_known.lower_bound(_root);
+		while (it != m_known.end() && it->first.HasPrefix(_root))
+		{
+			++it;
+		}
+		return it;
 	}
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file HelloWorld.usda after setting the color of /hello/world according to the variant selection:\n" << fileResult << std::endl;
+	void AddSubtree(const pxr::UsdPrim& _root)
+	{
+		for (pxr::UsdPrim prim : pxr::UsdPrimRange(_root, pxr::UsdPrimAllPrimsPredicate))
+		{
+			m_known[prim.GetPath()] = prim.IsActive();
+		}
+	}
 
-	// -- Step 6
-	std::cout << "---- Step 6 ----" << std::endl;
+	pxr::UsdStageRefPtr m_stage;
+	pxr::TfNotice::Key m_noticeKey;
+	std::vector<Subscriber> m_subscribers;
+	uint64_t m_sequence = 0;
+	std::map<pxr::SdfPath, bool> m_known; //!< the prims at the last flush, and whether they were active
+	std::set<pxr::SdfPath> m_resyncs;
+	std::set<pxr::SdfPath> m_attributes;
+};
 
-	/*! Python code from the tutorial
-		# Show flattened view of the stage
-		print(stage.ExportToString(addSourceFileComment=False))
+/*!
+@brief The reference subscriber of a SceneDeltaStream: a copy of the prims of a stage, with their
+	   type, active state, computed visibility and attribute values at the default time,
+	   kept up to date from the batches only.
+@details Matches() reads the whole stage again and compares, to check the stream.
+*/
+class SceneMirror
+{
+public:
+	SceneMirror(const pxr::UsdStageRefPtr& _stage, SceneDeltaStream& _stream)
+		: m_stage(_stage)
+		, m_sequence(_stream.GetSequence())
+	{
+		ReadSubtree(m_stage->GetPseudoRoot(), &m_prims);
+		_stream.Subscribe([this](const SceneDeltaStream::Batch& _batch) { Apply(_batch); });
+	}
+
+	void Apply(const SceneDeltaStream::Batch& _batch)
+	{
+		if (_batch.sequence != m_sequence + 1)
+		{
+			// a batch was missed, the events cannot be trusted anymore
+			m_prims.clear();
+			ReadSubtree(m_stage->GetPseudoRoot(), &m_prims);
+			++m_fullReads;
+		}
+		else
+		{
+			for (const SceneDeltaStream::Event& event : _batch.events)
+			{
+				ApplyEvent(event);
+			}
+		}
+		m_sequence = _batch.sequence;
+		m_appliedEvents += _batch.events.size();
+	}
+
+	/*!
+	@return true if the mirror is the same as a full read of the stage, else false with the first difference in _difference.
 	*/
+	bool Matches(std::string* _difference) const
+	{
+		std::map<pxr::SdfPath, PrimState> expected;
+		ReadSubtree(m_stage->GetPseudoRoot(), &expected);
 
-	// Write the C++ equivalent of the python code above
-	stage->ExportToString(&fileResult, false);
-	//note: Only the default variant is going to be shown in the flattened view
-	//		In particular, the green color is going to be used for the attribute displayColor of /hello/world
-	std::cout << "Flattened view of the stage of HelloWorld.usda:\n" << fileResult << std::endl;
+		auto mirrored = m_prims.begin();
+		auto read = expected.begin();
+		for (; mirrored != m_prims.end() && read != expected.end(); ++mirrored, ++read)
+		{
+			if (mirrored->first != read->first)
+			{
+				*_difference = "prim " + std::min(mirrored->first, read->first).GetString() + " is only in "
+					+ (mirrored->first < read->first ? "the mirror" : "the stage");
+				return false;
+			}
+			if (!(mirrored->second == read->second))
+			{
+				*_difference = "prim " + read->first.GetString() + " differs";
+				return false;
+			}
+		}
+		if (mirrored != m_prims.end() || read != expected.end())
+		{
+			*_difference = "prim " + (mirrored != m_prims.end() ? mirrored->first.GetString() + " is only in the mirror"
+				: read->first.GetString() + " is only in the stage");
+			return false;
+		}
+		return true;
+	}
 
-	// -- Step 7
-	std::cout << "---- Step 7 ----" << std::endl;
+	size_t GetPrimCount() const
+	{
+		return m_prims.size();
+	}
 
-	/*! Python code from the tutorial
-		# save in a new file HelloWorldWithVariants.usda
-		stage.GetRootLayer().Export('HelloWorldWithVariants.usda')
-	*/
+	size_t GetAppliedEvents() const
+	{
+		return m_appliedEvents;
+	}
 
-	// Write the C++ equivalent of the python code above
-	stage->GetRootLayer()->Export("HelloWorldWithVariants.usda");
-	std::cout << "The stage of HelloWorld.usda with variants has been saved in HelloWorldWithVariants.usda." << std::endl;
+	size_t GetFullReads() const
+	{
+		return m_fullReads;
+	}
 
-}
+private:
+	struct PrimState
+	{
+		pxr::TfToken typeName;
+		bool active = true;
+		pxr::TfToken visibility;
+		std::map<pxr::TfToken, pxr::VtValue> attributes;
 
-/*!
-@brief A utility function to wrap around the creation of a new stage.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@return A new stage.
-@see https://openusd.org/release/tut_xforms.html
-*/
-pxr::UsdStageRefPtr MakeInitialStage(std::string& _path)
-{
-	/*! Python code from the tutorial
-		stage = Usd.Stage.CreateNew(path)
-		UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.z)
-		stage.SetStartTimeCode(1)
-		stage.SetEndTimeCode(192)
-		return stage
-	*/
+		bool operator==(const PrimState& _other) const
+		{
+			return typeName == _other.typeName && active == _other.active && visibility == _other.visibility
+				&& attributes == _other.attributes;
+		}
+	};
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateNew(_path);
-	pxr::UsdGeomSetStageUpAxis(stage, pxr::UsdGeomTokens->z);
-	stage->SetStartTimeCode(1);
-	stage->SetEndTimeCode(192);
-	return stage;
-}
+	static pxr::TfToken ComputeVisibility(const pxr::UsdPrim& _prim)
+	{
+		return _prim.IsA<pxr::UsdGeomImageable>() ? pxr::UsdGeomImageable(_prim).ComputeVisibility() : pxr::TfToken();
+	}
 
-/*!
-@brief A utility function to add a reference to a geometry.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@return The xform prim that was added to the stage.
-@see https://openusd.org/release/tut_xforms.html#id3
-*/
-pxr::UsdGeomXform AddReferenceToGeometry(pxr::UsdStageRefPtr _stage, std::string _path)
+	static void ReadSubtree(const pxr::UsdPrim& _root, std::map<pxr::SdfPath, PrimState>* _prims)
+	{
+		for (pxr::UsdPrim prim : pxr::UsdPrimRange(_root, pxr::UsdPrimAllPrimsPredicate))
+		{
+			PrimState& state = (*_prims)[prim.GetPath()];
+			state.typeName = prim.GetTypeName();
+			state.active = prim.IsActive();
+			state.visibility = ComputeVisibility(prim);
+			for (const pxr::UsdAttribute& attribute : prim.GetAttributes())
+			{
+				attribute.Get(&state.attributes[attribute.GetName()]);
+			}
+		}
+	}
+
+	void EraseSubtree(const pxr::SdfPath& _root)
+	{
+		auto end = m_prims.lower_bound(_root);
+		while (end != m_prims.end() && end->first.HasPrefix(_root))
+		{
+			++end;
+		}
+		m_prims.erase(m_prims.lower_bound(_root), end);
+	}
+
+	void ApplyEvent(const SceneDeltaStream::Event& _event)
+	{
+		switch (_event.type)
+		{
+		case SceneDeltaStream::EventType::PrimRemoved:
+			EraseSubtree(_event.path);
+			break;
+		case SceneDeltaStream::EventType::AttributeChanged:
+		{
+			auto state = m_prims.find(_event.path.GetPrimPath());
+			pxr::UsdAttribute attribute = m_stage->GetAttributeAtPath(_event.path);
+			if (state == m_prims.end())
+			{
+				break;
+			}
+			if (attribute)
+			{
+				attribute.Get(&state->second.attributes[attribute.GetName()]);
+			}
+			else
+			{
+				state->second.attributes.erase(_event.path.GetNameToken());
+			}
+			break;
+		}
+		case SceneDeltaStream::EventType::VisibilityToggled:
+		{
+			pxr::UsdAttribute attribute = m_stage->GetAttributeAtPath(_event.path.AppendProperty(pxr::UsdGeomTokens->visibility));
+			for (auto state = m_prims.lower_bound(_event.path); state != m_prims.end() && state->first.HasPrefix(_event.path); ++state)
+			{
+				state->second.visibility = ComputeVisibility(m_stage->GetPrimAtPath(state->first));
+			}
+			auto state = m_prims.find(_event.path);
+			if (state != m_prims.end())
+			{
+				if (attribute)
+				{
+					attribute.Get(&state->second.attributes[pxr::UsdGeomTokens->visibility]);
+				}
+				else
+				{
+					state->second.attributes.erase(pxr::UsdGeomTokens->visibility);
+				}
+			}
+			break;
+		}
+		default: // added, resynced, or active toggled: read the subtree again
+			EraseSubtree(_event.path);
+			if (pxr::UsdPrim prim = m_stage->GetPrimAtPath(_event.path))
+			{
+				ReadSubtree(prim, &m_prims);
+			}
+			break;
+		}
+	}
+
+	pxr::UsdStageRefPtr m_stage;
+	uint64_t m_sequence;
+	std::map<pxr::SdfPath, PrimState> m_prims;
+	size_t m_appliedEvents = 0;
+	size_t m_fullReads = 0;
+};
+
+//! Prints a batch of a SceneDeltaStream, one event per line.
+void PrintSceneDeltaBatch(const SceneDeltaStream::Batch& _batch)
 {
-	/*! Python code from the tutorial
-		geom = UsdGeom.Xform.Define(stage, path)
-		geom.GetPrim().GetReferences().AddReference('./top.geom.usd')
-		return geom
-	*/
+	std::cout << "Scene delta batch " << _batch.sequence << ":" << std::endl;
+	for (const SceneDeltaStream::Event& event : _batch.events)
+	{
+		std::cout << "  " << SceneDeltaStream::ToString(event.type) << " " << event.path << std::endl;
+	}
+}
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomXform geom = pxr::UsdGeomXform::Define(_stage, pxr::SdfPath(_path));
-	geom.GetPrim().GetReferences().AddReference("./extras/top.geom.usd");
-	return geom;
+//! Prints whether the mirror still matches a full read of its stage.
+void CheckSceneMirror(const SceneMirror& _mirror)
+{
+	std::string difference;
+	bool matches = _mirror.Matches(&difference);
+	std::cout << "Mirror of " << _mirror.GetPrimCount() << " prims after " << _mirror.GetAppliedEvents() << " events: "
+		<< (matches ? "matches the stage" : "MISMATCH, " + difference) << std::endl;
 }
 
 /*!
-@brief A utility function to add a spin transformation to a geometry.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@see https://openusd.org/release/tut_xforms.html#id5
+@brief Function reproducing the sixth item of the Pixar USD tutorial
+@see https://openusd.org/release/tut_traversing_stage.html
 */
-void AddSpin(pxr::UsdGeomXform _geom)
+void TestFunction_PixarTutorial_StageTraversal()
 {
-	/*! Python code from the tutorial
-		spin = top.AddRotateZOp(opSuffix='spin')
-		spin.Set(time=1, value=0)
-		spin.Set(time=192, value=1440)
+	// This step of the tutorial originally uses usdview and the python interpreter.
+	// I will adapt the demonstrated commands to C++ code.
+
+	std::cout << "** TestFunction_PixarTutorial_StageTraversal **" << std::endl;
+
+	// -- Step 1
+	std::cout << "---- Step 1 ----" << std::endl;
+
+	/*! The Python commands in the interpreter
+		[x for x in usdviewApi.stage.Traverse()]
+		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2>), Usd.Prim(</refSphere2/world>)]
 	*/
 
 	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomXformOp spin = _geom.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, pxr::TfToken("spin"));
-	spin.Set(0.f, 1.f);//value is first and time is second
-	spin.Set(1440.f, 192.f);//value is first and time is second
-}
+	pxr::UsdStageRefPtr refStage = pxr::UsdStage::Open("RefExample.usda");
+	pxr::UsdPrimRange allPrims = refStage->Traverse();
+	std::cout << "All prims in the stage of RefExample.usda:" << std::endl;
+	for (pxr::UsdPrim prim : allPrims)
+	{
+		std::cout << prim.GetPath() << std::endl;
+	}
 
-/*!
-@brief A utility function to add a tilt transformation to a geometry.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@see https://openusd.org/release/tut_xforms.html#id7
-*/
-void AddTilt(pxr::UsdGeomXform _geom)
-{
-	/*! Python code from the tutorial
-		tilt = top.AddRotateXOp(opSuffix='tilt')
-		tilt.Set(value=12)
+	// -- Step 2
+	std::cout << "---- Step 2 ----" << std::endl;
+
+	/*! The Python commands in the interpreter
+		[x for x in usdviewApi.stage.Traverse() if UsdGeom.Sphere(x)]
+		# Output: [Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2/world>)]
 	*/
 
 	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomXformOp tilt = _geom.AddRotateXOp(pxr::UsdGeomXformOp::PrecisionFloat, pxr::TfToken("tilt"));
-	tilt.Set(12.f);
-}
+	std::vector<pxr::UsdGeomSphere> allSpheres;
+	for (const pxr::UsdPrim& prim : PrimQuery("type:Sphere").Run(refStage))
+	{
+		allSpheres.push_back(pxr::UsdGeomSphere(prim));
+	}
 
-/*!
-@brief A utility function to add an offset transformation to a geometry.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@see https://openusd.org/release/tut_xforms.html#id9
-*/
-void AddOffset(pxr::UsdGeomXform _geom)
-{
-	/*! Python  code from the tutorial
-		top.AddTranslateOp(opSuffix='offset').Set(value=(0, 0.1, 0))
+	std::cout << "All prims in the stage of RefExample.usda that are UsdGeomSpheres:\n" << std::endl;
+	for (pxr::UsdGeomSphere sphere : allSpheres)
+	{
+		std::cout << sphere.GetPath() << std::endl;
+	}
+	
+
+	// -- Step 3
+	std::cout << "---- Step 3 ----" << std::endl;
+
+	/*! The Python commands in the interpreter
+		
+		primIter = iter(Usd.PrimRange.PreAndPostVisit(usdviewApi.stage.GetPseudoRoot()))
+		for x in primIter: print(x, primIter.IsPostVisit())
+
+		# Output:
+		Usd.Prim(</>) False
+		Usd.Prim(</refSphere>) False
+		Usd.Prim(</refSphere/world>) False
+		Usd.Prim(</refSphere/world>) True
+		Usd.Prim(</refSphere>) True
+		Usd.Prim(</refSphere2>) False
+		Usd.Prim(</refSphere2/world>) False
+		Usd.Prim(</refSphere2/world>) True
+		Usd.Prim(</refSphere2>) True
+		Usd.Prim(</>) True
 	*/
 
 	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomXformOp offset = _geom.AddTranslateOp(pxr::UsdGeomXformOp::PrecisionFloat, pxr::TfToken("offset"));
-	offset.Set(pxr::GfVec3f(0, 0.1, 0));
-}
+	pxr::UsdPrimRange pseudoRoot = pxr::UsdPrimRange::PreAndPostVisit(refStage->GetPseudoRoot());
+	std::cout << "All prims in the stage of RefExample.usda with pre and post visit:\n" << std::endl;
+	for (auto it = pseudoRoot.begin(); it != pseudoRoot.end(); ++it)
+	{
+		std::cout << (*it).GetPath() << " " << (it.IsPostVisit() ? "True" : "False") << std::endl;
+	}
 
-/*!
-@brief A utility function to add a precession transformation to a geometry.
-@details This function is used in the Pixar tutorial on transformations and animations.
-@see https://openusd.org/release/tut_xforms.html#id9
-*/
-void AddPrecession(pxr::UsdGeomXform _geom)
-{
-	/*! Python code from the tutorial
-		precess = top.AddRotateZOp(opSuffix='precess')
-		precess.Set(time=1, value=0)
-		precess.Set(time=192, value=360)
+	// -- Step 4
+	std::cout << "---- Step 4 ----" << std::endl;
+
+	/*! The Python commands in the interpreter
+		
+		# First, manually inactivate the reference to refSphere2
+
+		# Then Print the prims in the stage
+		[x for x in usdviewApi.stage.Traverse()]
+		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>)]
+
+		[x for x in usdviewApi.stage.TraverseAll()]
+		# Output: [Usd.Prim(</refSphere>), Usd.Prim(</refSphere/world>), Usd.Prim(</refSphere2>)]
 	*/
 
 	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomXformOp precession = _geom.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, pxr::TfToken("precess"));
-	precession.Set(0.f, 1.0f);
-	precession.Set(360.f, 192.f);
+	// A consumer following the stage through deltas, instead of traversing it again after the edit.
+	SceneDeltaStream deltas(refStage);
+	SceneMirror mirror(refStage, deltas);
+	deltas.Subscribe(PrintSceneDeltaBatch);
+
+	refStage->OverridePrim(pxr::SdfPath("/refSphere2")).SetActive(false);
+
+	deltas.Flush();
+	CheckSceneMirror(mirror);
+
+	//print the stage to check that it's marked as inactive
+	std::string fileResult;
+	refStage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file RefExample.usda after deactivating refSphere2:\n" << fileResult << std::endl;
+
+	//Accoding to documentation: "refStage->Traverse(): Traverse the active, loaded, defined, non-abstract prims on this stage depth-first."
+	std::cout << "Prims (active, loaded, defined, non-abstract) in the stage of RefExample.usda after deactivating refSphere2:" << std::endl;
+	for (pxr::UsdPrim prim : refStage->Traverse())
+	{
+		std::cout << prim.GetPath() << std::endl;
+	}
+
+	std::cout << std::endl; //just for layout of the ouput
+
+	//According to documentation "refStage->TraverseAll(): Traverse all the prims on this stage depth-first."
+	std::cout << "All Prims in the stage of RefExample.usda after deactivating refSphere2:" << std::endl;
+	for (pxr::UsdPrim prim : refStage->TraverseAll())
+	{
+		std::cout << prim.GetPath() << std::endl;
+	}
+
+	std::cout << std::endl; //just for layout of the ouput
+
+	// The same kind of question asked with a query, which visits only the subtrees that can match.
+	PrimQuery inactiveQuery("under:/refSphere* active:false");
+	std::cout << "Prims matching \"under:/refSphere* active:false\":" << std::endl;
+	for (const pxr::UsdPrim& prim : inactiveQuery.Run(refStage))
+	{
+		std::cout << prim.GetPath() << std::endl;
+	}
+
+	PrimQueryIndex index(refStage);
+	PrimQuery sphereQuery("type:Sphere under:/refSphere* has:primvars:displayColor");
+	std::cout << "Prims matching \"type:Sphere under:/refSphere* has:primvars:displayColor\" (from the index):" << std::endl;
+	for (const pxr::UsdPrim& prim : sphereQuery.Run(refStage, &index))
+	{
+		std::cout << prim.GetPath() << std::endl;
+	}
 }
 
-void TestFunction_PixarTutorial_TransformationsAndAnimations()
+/*!
+@brief Function reproducing the Pixar USD tutorial on authoring variants
+@see https://openusd.org/release/tut_authoring_variants.html
+*/
+void TestFunction_PixarTutorial_AuthoringVariants()
 {
-	
-	std::cout << std::endl << "** TestFunction_PixarTutorial_TransformationsAndAnimations **" << std::endl;
+	std::cout << "** TestFunction_PixarTutorial_AuthoringVariants **" << std::endl;
 
-	// -- Step 1
+// -- Step 1
 	std::cout << "---- Step 1 ----" << std::endl;
 
 	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step1.usda')
-		stage.SetMetadata('comment', 'Step 1: Start and end time codes')
-		stage.Save()
+		from pxr import Usd, UsdGeom
+		stage = Usd.Stage.Open('HelloWorld.usda')
+		colorAttr = UsdGeom.Gprim.Get(stage, '/hello/world').GetDisplayColorAttr()
+		colorAttr.Clear()
 		print(stage.GetRootLayer().ExportToString())
 	*/
 
 	// Write the C++ equivalent of the python code above
-	std::string path = "Step1.usda";
-	pxr::UsdStageRefPtr stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 1: Start and end time codes");
-	stage->GetRootLayer()->Save();
 
+	//note: Local "opinions" in prims are stronger than variant selections.
+	//		Therefore, the color of /hello/world is going to be cleared before adding 
+	//		variants to a variant set.
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::Open("HelloWorld.usda");
+	pxr::UsdGeomGprim gprim = pxr::UsdGeomGprim::Get(stage, pxr::SdfPath("/hello/world"));
+	pxr::UsdAttribute colorAttr = gprim.GetDisplayColorAttr();
+	colorAttr.Clear();
+	
 	std::string fileResult;
 	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step1.usda:\n" << fileResult << std::endl;
+	std::cout << "Content of file HelloWorld.usda after clearing the display color of /hello/world:\n" << fileResult << std::endl;
 
 	// -- Step 2
 	std::cout << "---- Step 2 ----" << std::endl;
 
-	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step2.usda')
-		stage.SetMetadata('comment', 'Step 2: Geometry reference')
-		top = AddReferenceToGeometry(stage, '/Top')
-		stage.Save()
+	/*!Python code from the tutorial
+		rootPrim = stage.GetPrimAtPath('/hello')
+		vset = rootPrim.GetVariantSets().AddVariantSet('shadingVariant')
 		print(stage.GetRootLayer().ExportToString())
 	*/
-
+	
 	// Write the C++ equivalent of the python code above
-	path = "Step2.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 2: Geometry reference");
-	pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
-	stage->GetRootLayer()->Save();
+	pxr::UsdPrim rootPrim = stage->GetPrimAtPath(pxr::SdfPath("/hello"));
+	pxr::UsdVariantSet vset = rootPrim.GetVariantSets().AddVariantSet("shadingVariant");
 
 	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step2.usda:\n" << fileResult << std::endl;
+	std::cout << "Content of file HelloWorld.usda after adding a variant set to /hello:\n" << fileResult << std::endl;
 
 	// -- Step 3
 	std::cout << "---- Step 3 ----" << std::endl;
 
 	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step3.usda')
-		stage.SetMetadata('comment', 'Step 3: Adding spin animation')
-		top = AddReferenceToGeometry(stage, '/Top')
-		AddSpin(top)
-		stage.Save()
+		vset.AddVariant('red')
+		vset.AddVariant('blue')
+		vset.AddVariant('green')
 		print(stage.GetRootLayer().ExportToString())
 	*/
 
 	// Write the C++ equivalent of the python code above
-	path = "Step3.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 3: Adding spin animation");
-	top = AddReferenceToGeometry(stage, "/Top");
-	AddSpin(top);
-	stage->GetRootLayer()->Save();
-
+	vset.AddVariant("red");
+	vset.AddVariant("blue");
+	vset.AddVariant("green");
+	
 	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step3.usda:\n" << fileResult << std::endl;
-
-	// -- Step 4
-	std::cout << "---- Step 4 ----" << std::endl;
+	std::cout << "Content of file HelloWorld.usda after adding variants to the variant set of /hello:\n" << fileResult << std::endl;
+
+	// -- Step 4 & 5
+	std::cout << "---- Step 4 & 5 ----" << std::endl;
+
+	/*!
+		vset.SetVariantSelection('red')
+		with vset.GetVariantEditContext():
+			colorAttr.Set([(1,0,0)])
+
+		vset.SetVariantSelection('blue')
+		with vset.GetVariantEditContext():
+			colorAttr.Set([(0,0,1)])
+
+		vset.SetVariantSelection('green')
+		with vset.GetVariantEditContext():
+			colorAttr.Set([(0,1,0)])
 
-	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step4.usda')
-		stage.SetMetadata('comment', 'Step 4: Adding tilt')
-		top = AddReferenceToGeometry(stage, '/Top')
-		AddTilt(top)
-		AddSpin(top)
-		stage.Save()
 		print(stage.GetRootLayer().ExportToString())
 	*/
 
 	// Write the C++ equivalent of the python code above
-	path = "Step4.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 4: Adding tilt");
-	top = AddReferenceToGeometry(stage, "/Top");
-	AddTilt(top);
-	AddSpin(top);
-	stage->GetRootLayer()->Save();
+	vset.SetVariantSelection("red");
+	{
+		pxr::UsdEditContext context(vset.GetVariantEditContext());
+		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(1, 0, 0) }));
+	}
+
+	vset.SetVariantSelection("blue");
+	{
+		pxr::UsdEditContext context(vset.GetVariantEditContext());
+		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) }));
+	}
+
+	vset.SetVariantSelection("green");//note: this is going to stay as the default selected variant in helloWorld.usda
+	{
+		pxr::UsdEditContext context(vset.GetVariantEditContext());
+		colorAttr.Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 1, 0) }));
+	}
 
 	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step4.usda:\n" << fileResult << std::endl;
+	std::cout << "Content of file HelloWorld.usda after setting the color of /hello/world according to the variant selection:\n" << fileResult << std::endl;
 
-	// -- Step 4A
-	std::cout << "---- Step 4A ----" << std::endl;
+	// -- Step 6
+	std::cout << "---- Step 6 ----" << std::endl;
 
 	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step4A.usda')
-		stage.SetMetadata('comment', 'Step 4A: Adding spin and tilt')
-		top = AddReferenceToGeometry(stage, '/Top')
-		AddSpin(top)
-		AddTilt(top)
+		# Show flattened view of the stage
+		print(stage.ExportToString(addSourceFileComment=False))
+	*/
+
+	// Write the C++ equivalent of the python code above
+	stage->ExportToString(&fileResult, false);
+	//note: Only the default variant is going to be shown in the flattened view
+	//		In particular, the green color is going to be used for the attribute displayColor of /hello/world
+	std::cout << "Flattened view of the stage of HelloWorld.usda:\n" << fileResult << std::endl;
+
+	// -- Step 7
+	std::cout << "---- Step 7 ----" << std::endl;
+
+	/*! Python code from the tutorial
+		# save in a new file HelloWorldWithVariants.usda
+		stage.GetRootLayer().Export('HelloWorldWithVariants.usda')
+	*/
+
+	// Write the C++ equivalent of the python code above
+	stage->GetRootLayer()->Export("HelloWorldWithVariants.usda");
+	std::cout << "The stage of HelloWorld.usda with variants has been saved in HelloWorldWithVariants.usda." << std::endl;
+
+	// Switching the variant is seen by a consumer of the deltas as a resync of /hello.
+	SceneDeltaStream deltas(stage);
+	SceneMirror mirror(stage, deltas);
+	deltas.Subscribe(PrintSceneDeltaBatch);
+	for (const char* variant : { "red", "blue", "green" })
+	{
+		vset.SetVariantSelection(variant);
+		deltas.Flush();
+		CheckSceneMirror(mirror);
+	}
+
+}
+
+/*!
+@brief A utility function to wrap around the creation of a new stage.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@return A new stage.
+@see https://openusd.org/release/tut_xforms.html
+*/
+pxr::UsdStageRefPtr MakeInitialStage(std::string& _path)
+{
+	/*! Python code from the tutorial
+		stage = Usd.Stage.CreateNew(path)
+		UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.z)
+		stage.SetStartTimeCode(1)
+		stage.SetEndTimeCode(192)
+		return stage
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateNew(_path);
+	pxr::UsdGeomSetStageUpAxis(stage, pxr::UsdGeomTokens->z);
+	stage->SetStartTimeCode(1);
+	stage->SetEndTimeCode(192);
+	return stage;
+}
+
+/*!
+@brief A utility function to add a reference to a geometry.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@return The xform prim that was added to the stage.
+@see https://openusd.org/release/tut_xforms.html#id3
+*/
+pxr::UsdGeomXform AddReferenceToGeometry(pxr::UsdStageRefPtr _stage, std::string _path)
+{
+	/*! Python code from the tutorial
+		geom = UsdGeom.Xform.Define(stage, path)
+		geom.GetPrim().GetReferences().AddReference('./top.geom.usd')
+		return geom
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomXform geom = pxr::UsdGeomXform::Define(_stage, pxr::SdfPath(_path));
+	geom.GetPrim().GetReferences().AddReference("./extras/top.geom.usd");
+	return geom;
+}
+
+/*!
+@brief A utility function to add a spin transformation to a geometry.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@see https://openusd.org/release/tut_xforms.html#id5
+*/
+void AddSpin(pxr::UsdGeomXform _geom)
+{
+	/*! Python code from the tutorial
+		spin = top.AddRotateZOp(opSuffix='spin')
+		spin.Set(time=1, value=0)
+		spin.Set(time=192, value=1440)
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomXformOp spin = _geom.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->spin);
+	spin.Set(0.f, 1.f);//value is first and time is second
+	spin.Set(1440.f, 192.f);//value is first and time is second
+}
+
+/*!
+@brief A utility function to add a tilt transformation to a geometry.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@see https://openusd.org/release/tut_xforms.html#id7
+*/
+void AddTilt(pxr::UsdGeomXform _geom)
+{
+	/*! Python code from the tutorial
+		tilt = top.AddRotateXOp(opSuffix='tilt')
+		tilt.Set(value=12)
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomXformOp tilt = _geom.AddRotateXOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->tilt);
+	tilt.Set(12.f);
+}
+
+/*!
+@brief A utility function to add an offset transformation to a geometry.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@see https://openusd.org/release/tut_xforms.html#id9
+*/
+void AddOffset(pxr::UsdGeomXform _geom)
+{
+	/*! Python  code from the tutorial
+		top.AddTranslateOp(opSuffix='offset').Set(value=(0, 0.1, 0))
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomXformOp offset = _geom.AddTranslateOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->offset);
+	offset.Set(pxr::GfVec3f(0, 0.1, 0));
+}
+
+/*!
+@brief A utility function to add a precession transformation to a geometry.
+@details This function is used in the Pixar tutorial on transformations and animations.
+@see https://openusd.org/release/tut_xforms.html#id9
+*/
+void AddPrecession(pxr::UsdGeomXform _geom)
+{
+	/*! Python code from the tutorial
+		precess = top.AddRotateZOp(opSuffix='precess')
+		precess.Set(time=1, value=0)
+		precess.Set(time=192, value=360)
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomXformOp precession = _geom.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->precess);
+	precession.Set(0.f, 1.0f);
+	precession.Set(360.f, 192.f);
+}
+
+/*!
+@brief Authors and saves independent stages concurrently.
+@details Every job creates, authors and returns its own stage, which the runner saves on the
+		 same thread. A stage is never shared between jobs, since a UsdStage must not be edited
+		 from several threads at once, but different stages can.
+		 Layers that all the jobs reference (like top.geom.usd) are opened once beforehand and
+		 kept alive during the run, so the compositions of the jobs find them in the layer
+		 registry and only read them.
+		 The jobs run on the threads of the work library, so PXR_WORK_THREAD_LIMIT is honored.
+*/
+class StageJobRunner
+{
+public:
+	//! What a job produced, the results are in the order the jobs were added.
+	struct Result
+	{
+		std::string name;
+		std::string path;      //!< display name of the root layer
+		std::string content;   //!< the root layer exported to a string once saved
+		bool saved = false;
+		double seconds = 0.;   //!< time spent authoring and saving the stage
+	};
+
+	/*!
+	@brief Opens a layer that is referenced by the jobs and keeps it open until the runner is destroyed.
+	*/
+	void AddSharedLayer(const std::string& _path)
+	{
+		pxr::SdfLayerRefPtr layer = pxr::SdfLayer::FindOrOpen(_path);
+		if (layer)
+		{
+			m_sharedLayers.push_back(layer);
+		}
+	}
+
+	void AddJob(const std::string& _name, std::function<pxr::UsdStageRefPtr()> _author)
+	{
+		m_jobs.push_back({ _name, std::move(_author) });
+	}
+
+	/*!
+	@brief Runs all the jobs added so far and waits for them.
+	*/
+	std::vector<Result> Run()
+	{
+		std::vector<Result> results(m_jobs.size());
+		auto start = std::chrono::steady_clock::now();
+		{
+			pxr::WorkDispatcher dispatcher;
+			for (size_t i = 0; i < m_jobs.size(); ++i)
+			{
+				dispatcher.Run([this, i, &results]()
+				{
+					Result& result = results[i];
+					result.name = m_jobs[i].name;
+
+					auto jobStart = std::chrono::steady_clock::now();
+					pxr::UsdStageRefPtr stage = m_jobs[i].author();
+					if (!stage)
+					{
+						return;
+					}
+					pxr::SdfLayerHandle rootLayer = stage->GetRootLayer();
+					result.saved = rootLayer->Save();
+					result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+
+					result.path = rootLayer->GetDisplayName();
+					rootLayer->ExportToString(&result.content);
+				});
+			}
+			dispatcher.Wait();
+		}
+		m_wallClockSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		m_jobs.clear();
+		return results;
+	}
+
+	//! The duration of the last Run(), to compare with the sum of the job durations.
+	double GetWallClockSeconds() const
+	{
+		return m_wallClockSeconds;
+	}
+
+private:
+	struct Job
+	{
+		std::string name;
+		std::function<pxr::UsdStageRefPtr()> author;
+	};
+
+	std::vector<Job> m_jobs;
+	std::vector<pxr::SdfLayerRefPtr> m_sharedLayers;
+	double m_wallClockSeconds = 0.;
+};
+
+void TestFunction_PixarTutorial_TransformationsAndAnimations()
+{
+	
+	std::cout << std::endl << "** TestFunction_PixarTutorial_TransformationsAndAnimations **" << std::endl;
+
+	// Steps 1 to 5 are independent stages, they are authored and saved concurrently.
+	// All of them reference the same geometry, which is opened only once.
+	StageJobRunner runner;
+	runner.AddSharedLayer("./extras/top.geom.usd");
+
+	// -- Step 1
+
+	/*! Python code from the tutorial
+		stage = MakeInitialStage('Step1.usda')
+		stage.SetMetadata('comment', 'Step 1: Start and end time codes')
 		stage.Save()
 		print(stage.GetRootLayer().ExportToString())
 	*/
 
 	// Write the C++ equivalent of the python code above
-	path = "Step4A.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 4A: Adding spin and tilt");
-	top = AddReferenceToGeometry(stage, "/Top");
-	AddSpin(top);
-	AddTilt(top);
-	stage->GetRootLayer()->Save();
+	runner.AddJob("Step 1", []()
+	{
+		std::string path = "Step1.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 1: Start and end time codes");
+		return stage;
+	});
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step4A.usda (Added Spin BEFORE Tilt):\n" << fileResult << std::endl;
+	// -- Step 2
 
-	// -- Step 5
-	std::cout << "---- Step 5 ----" << std::endl;
+	/*! Python code from the tutorial
+		stage = MakeInitialStage('Step2.usda')
+		stage.SetMetadata('comment', 'Step 2: Geometry reference')
+		top = AddReferenceToGeometry(stage, '/Top')
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	runner.AddJob("Step 2", []()
+	{
+		std::string path = "Step2.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 2: Geometry reference");
+		pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
+		return stage;
+	});
+
+	// -- Step 3
 
 	/*! Python code from the tutorial
-		stage = MakeInitialStage('Step5.usda')
-		stage.SetMetadata('comment', 'Step 5: Adding precession and offset')
+		stage = MakeInitialStage('Step3.usda')
+		stage.SetMetadata('comment', 'Step 3: Adding spin animation')
 		top = AddReferenceToGeometry(stage, '/Top')
-		AddPrecession(top)
-		AddOffset(top)
-		AddTilt(top)
 		AddSpin(top)
 		stage.Save()
 		print(stage.GetRootLayer().ExportToString())
 	*/
 
 	// Write the C++ equivalent of the python code above
-	path = "Step5.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 5: Adding precession and offset");
-	top = AddReferenceToGeometry(stage, "/Top");
-	AddPrecession(top);
-	AddOffset(top);
-	AddTilt(top);
-	AddSpin(top);
-	stage->GetRootLayer()->Save();
+	runner.AddJob("Step 3", []()
+	{
+		std::string path = "Step3.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 3: Adding spin animation");
+		pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
+		AddSpin(top);
+		return stage;
+	});
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step5.usda:\n" << fileResult << std::endl;
+	// -- Step 4
+
+	/*! Python code from the tutorial
+		stage = MakeInitialStage('Step4.usda')
+		stage.SetMetadata('comment', 'Step 4: Adding tilt')
+		top = AddReferenceToGeometry(stage, '/Top')
+		AddTilt(top)
+		AddSpin(top)
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	runner.AddJob("Step 4", []()
+	{
+		std::string path = "Step4.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 4: Adding tilt");
+		pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
+		AddTilt(top);
+		AddSpin(top);
+		return stage;
+	});
+
+	// -- Step 4A
+
+	/*! Python code from the tutorial
+		stage = MakeInitialStage('Step4A.usda')
+		stage.SetMetadata('comment', 'Step 4A: Adding spin and tilt')
+		top = AddReferenceToGeometry(stage, '/Top')
+		AddSpin(top)
+		AddTilt(top)
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	runner.AddJob("Step 4A", []()
+	{
+		std::string path = "Step4A.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 4A: Adding spin and tilt");
+		pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
+		AddSpin(top);
+		AddTilt(top);
+		return stage;
+	});
+
+	// -- Step 5
+
+	/*! Python code from the tutorial
+		stage = MakeInitialStage('Step5.usda')
+		stage.SetMetadata('comment', 'Step 5: Adding precession and offset')
+		top = AddReferenceToGeometry(stage, '/Top')
+		AddPrecession(top)
+		AddOffset(top)
+		AddTilt(top)
+		AddSpin(top)
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	runner.AddJob("Step 5", []()
+	{
+		std::string path = "Step5.usda";
+		pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+		stage->SetMetadata(_authoringTokens->comment, "Step 5: Adding precession and offset");
+		pxr::UsdGeomXform top = AddReferenceToGeometry(stage, "/Top");
+		AddPrecession(top);
+		AddOffset(top);
+		AddTilt(top);
+		AddSpin(top);
+		return stage;
+	});
+
+	// The jobs are done in any order, the results are printed in the order of the tutorial.
+	std::vector<StageJobRunner::Result> results = runner.Run();
+	for (const StageJobRunner::Result& result : results)
+	{
+		std::cout << "---- " << result.name << " ----" << std::endl;
+		std::cout << "Content of file " << result.path << " (authored and saved in " << result.seconds << " s"
+			<< (result.saved ? "" : ", SAVE FAILED") << "):\n" << result.content << std::endl;
+	}
+	std::cout << "Steps 1 to 5 generated in " << runner.GetWallClockSeconds() << " s." << std::endl;
+
+	// -- Step 6
+	std::cout << "---- Step 6 ----" << std::endl;
+
+	/*! Python code from the tutorial
+		# Use animated layer from Step5
+		anim_layer_path = './Step5.usda'
+
+		stage = MakeInitialStage('Step6.usda')
+		stage.SetMetadata('comment', 'Step 6: Layer offsets and animation')
+
+		left = UsdGeom.Xform.Define(stage, '/Left')
+		left_top = UsdGeom.Xform.Define(stage, '/Left/Top')
+		left_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top')
+
+		middle = UsdGeom.Xform.Define(stage, '/Middle')
+		middle.AddTranslateOp().Set(value=(2, 0, 0))
+		middle_top = UsdGeom.Xform.Define(stage, '/Middle/Top')
+		middle_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top', layerOffset = Sdf.LayerOffset(offset=96))
+
+		right = UsdGeom.Xform.Define(stage, '/Right')
+		right.AddTranslateOp().Set(value=(4, 0, 0))
+		right_top = UsdGeom.Xform.Define(stage, '/Right/Top')
+		right_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top', layerOffset = Sdf.LayerOffset(scale=0.25))
+
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	std::string anim_layer_path = "./Step5.usda";
+
+	std::string path = "Step6.usda";
+	pxr::UsdStageRefPtr stage = MakeInitialStage(path);
+	stage->SetMetadata(_authoringTokens->comment, "Step 6: Layer offsets and animation");
+
+	pxr::UsdGeomXform left = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Left"));
+	pxr::UsdGeomXform left_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Left/Top"));
+	left_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"));
+
+	pxr::UsdGeomXform middle = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Middle"));
+	middle.AddTranslateOp().Set(pxr::GfVec3d(2, 0, 0));
+	pxr::UsdGeomXform middle_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Middle/Top"));
+	middle_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"), pxr::SdfLayerOffset(96.));
+
+	pxr::UsdGeomXform right = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Right"));
+	right.AddTranslateOp().Set(pxr::GfVec3d(4, 0, 0));
+	pxr::UsdGeomXform right_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Right/Top"));
+	right_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"), pxr::SdfLayerOffset(0.0, 0.25));
+
+	stage->GetRootLayer()->Save();
+
+	std::string fileResult;
+	stage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file Step6.usda:\n" << fileResult << std::endl;
+}
+
+void TestFunction_PixarTutorial_SimpleShading()
+{
+	std::cout << "** TestFunction_PixarTutorial_SimpleShading **" << std::endl;
+
+	// simpleShading.usd is a crate file, saving it again only appends what changed in between.
+	IncrementalLayerSaver saver;
+
+	// -- Step 1
+	std::cout << "---- Step 1 ; Making a Model ----" << std::endl;
+
+	/*! Python code from the tutorial
+		stage = Usd.Stage.CreateNew("simpleShading.usd")
+		UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.y)
+		
+		modelRoot = UsdGeom.Xform.Define(stage, "/TexModel")
+		Usd.ModelAPI(modelRoot).SetKind(Kind.Tokens.component)
+
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateNew("simpleShading.usd");
+	pxr::UsdGeomSetStageUpAxis(stage, pxr::UsdGeomTokens->y);
+
+	pxr::UsdGeomXform modelRoot = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/TexModel"));
+	pxr::UsdModelAPI(modelRoot).SetKind(pxr::KindTokens->component);
+
+	std::string fileResult;
+	stage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file simpleShading.usd:\n" << fileResult << std::endl;
+
+	// -- Step 2
+	std::cout << "---- Step 2 ; Adding a Mesh “Billboard” ----" << std::endl;
+
+	/*! Python code from the tutorial
+		billboard = UsdGeom.Mesh.Define(stage, "/TexModel/card")
+		billboard.CreatePointsAttr([(-430, -145, 0), (430, -145, 0), (430, 145, 0), (-430, 145, 0)])
+		billboard.CreateFaceVertexCountsAttr([4])
+		billboard.CreateFaceVertexIndicesAttr([0,1,2,3])
+		billboard.CreateExtentAttr([(-430, -145, 0), (430, 145, 0)])
+		texCoords = UsdGeom.PrimvarsAPI(billboard).CreatePrimvar("st",
+		                                    Sdf.ValueTypeNames.TexCoord2fArray,
+		                                    UsdGeom.Tokens.varying)
+		texCoords.Set([(0, 0), (1, 0), (1,1), (0, 1)])
+		
+		stage.Save()
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdGeomMesh billboard = pxr::UsdGeomMesh::Define(stage, pxr::SdfPath("/TexModel/card"));
+	billboard.CreatePointsAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, -145, 0), pxr::GfVec3f(430, 145, 0), pxr::GfVec3f(-430, 145, 0) }));
+	billboard.CreateFaceVertexCountsAttr().Set(pxr::VtIntArray({ 4 }));
+	billboard.CreateFaceVertexIndicesAttr().Set(pxr::VtIntArray({ 0, 1, 2, 3 }));
+	billboard.CreateExtentAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, 145, 0) }));
+	pxr::UsdGeomPrimvar texCoords = pxr::UsdGeomPrimvarsAPI(billboard).CreatePrimvar(_authoringTokens->st,
+		pxr::SdfValueTypeNames->TexCoord2fArray,
+		pxr::UsdGeomTokens->varying);
+	texCoords.Set(pxr::VtVec2fArray({ pxr::GfVec2f(0, 0), pxr::GfVec2f(1, 0), pxr::GfVec2f(1, 1), pxr::GfVec2f(0, 1) }));
+
+	IncrementalLayerSaver::SaveResult saveResult = saver.Save(stage->GetRootLayer());
+	std::cout << "simpleShading.usd " << IncrementalLayerSaver::ToString(saveResult) << std::endl;
+
+	stage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file simpleShading.usd after adding a card mesh to the TexModel:\n" << fileResult << std::endl;
+
+	// -- Step 3
+	std::cout << "---- Step 3 ; Make a Material ----" << std::endl;
+
+	/*! Python code from the tutorial
+		material = UsdShade.Material.Define(stage, '/TexModel/boardMat')	
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdShadeMaterial material = pxr::UsdShadeMaterial::Define(stage, pxr::SdfPath("/TexModel/boardMat"));
+
+	// -- Step 4
+	std::cout << "---- Step 4 ; Add a UsdPreviewSurface ----" << std::endl;
+
+	/*! Python code from the tutorial
+		pbrShader = UsdShade.Shader.Define(stage, '/TexModel/boardMat/PBRShader')
+		pbrShader.CreateIdAttr("UsdPreviewSurface")
+		pbrShader.CreateInput("roughness", Sdf.ValueTypeNames.Float).Set(0.4)
+		pbrShader.CreateInput("metallic", Sdf.ValueTypeNames.Float).Set(0.0)
+		
+		material.CreateSurfaceOutput().ConnectToSource(pbrShader.ConnectableAPI(), "surface")
+
+		print(stage.GetRootLayer().ExportToString())
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdShadeShader pbrShader = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/PBRShader"));
+	pbrShader.CreateIdAttr().Set(_authoringTokens->usdPreviewSurface);
+	pbrShader.CreateInput(_authoringTokens->roughness, pxr::SdfValueTypeNames->Float).Set(0.4f);
+	pbrShader.CreateInput(_authoringTokens->metallic, pxr::SdfValueTypeNames->Float).Set(0.0f);
+
+	material.CreateSurfaceOutput().ConnectToSource(pbrShader.ConnectableAPI(), _authoringTokens->surface);
+
+	stage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file simpleShading.usd after adding a PBRShader shader to the boardMat:\n" << fileResult << std::endl;
+
+	// -- Step 5
+	std::cout << "---- Step 5 ; Add Texturing ----" << std::endl;
+
+	/*! Python code from the Tutorial
+		stReader = UsdShade.Shader.Define(stage, '/TexModel/boardMat/stReader')
+		stReader.CreateIdAttr('UsdPrimvarReader_float2')
+		
+		diffuseTextureSampler = UsdShade.Shader.Define(stage,'/TexModel/boardMat/diffuseTexture')
+		diffuseTextureSampler.CreateIdAttr('UsdUVTexture')
+		diffuseTextureSampler.CreateInput('file', Sdf.ValueTypeNames.Asset).Set("USDLogoLrg.png")
+		diffuseTextureSampler.CreateInput("st", Sdf.ValueTypeNames.Float2).ConnectToSource(stReader.ConnectableAPI(), 'result')
+		diffuseTextureSampler.CreateOutput('rgb', Sdf.ValueTypeNames.Float3)
+		pbrShader.CreateInput("diffuseColor", Sdf.ValueTypeNames.Color3f).ConnectToSource(diffuseTextureSampler.ConnectableAPI(), 'rgb')
+		
+		stInput = material.CreateInput('frame:stPrimvarName', Sdf.ValueTypeNames.Token)
+		stInput.Set('st')
+		
+		stReader.CreateInput('varname',Sdf.ValueTypeNames.Token).ConnectToSource(stInput)
+		
+		billboard.GetPrim().ApplyAPI(UsdShade.MaterialBindingAPI)
+		UsdShade.MaterialBindingAPI(billboard).Bind(material)
+		
+		stage.Save()
+	*/
+
+	// Write the C++ equivalent of the python code above
+	pxr::UsdShadeShader stReader = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/stReader"));
+	stReader.CreateIdAttr().Set(_authoringTokens->usdPrimvarReaderFloat2);
+
+	pxr::UsdShadeShader diffuseTextureSampler = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/diffuseTexture"));
+	diffuseTextureSampler.CreateIdAttr().Set(_authoringTokens->usdUVTexture);
+	diffuseTextureSampler.CreateInput(_authoringTokens->file, pxr::SdfValueTypeNames->Asset).Set(pxr::SdfAssetPath("./extras/USDLogoLrg.png"));
+	diffuseTextureSampler.CreateInput(_authoringTokens->st, pxr::SdfValueTypeNames->Float2).ConnectToSource(stReader.ConnectableAPI(), _authoringTokens->result);
+	diffuseTextureSampler.CreateOutput(_authoringTokens->rgb, pxr::SdfValueTypeNames->Float3);
+	pbrShader.CreateInput(_authoringTokens->diffuseColor, pxr::SdfValueTypeNames->Color3f).ConnectToSource(diffuseTextureSampler.ConnectableAPI(), _authoringTokens->rgb);
+	
+	pxr::UsdAttribute stInput = material.CreateInput(_authoringTokens->frameStPrimvarName, pxr::SdfValueTypeNames->Token);
+	stInput.Set(_authoringTokens->st);
+
+	stReader.CreateInput(_authoringTokens->varname, pxr::SdfValueTypeNames->Token).ConnectToSource(stInput.GetPath());
+
+	billboard.GetPrim().ApplyAPI(_authoringTokens->materialBindingAPI);//note: the plugin usdShade MUST be loaded
+	pxr::UsdShadeMaterialBindingAPI(billboard).Bind(material);
+
+	std::cout << "Specs changed since the last save: " << saver.GetChangedSpecs(stage->GetRootLayer()).size() << std::endl;
+	saveResult = saver.Save(stage->GetRootLayer());
+	std::cout << "simpleShading.usd " << IncrementalLayerSaver::ToString(saveResult) << std::endl;
+	stage->GetRootLayer()->ExportToString(&fileResult);
+	std::cout << "Content of file simpleShading.usd after adding texturing to the boardMat:\n" << fileResult << std::endl;
+}
+
+/*!
+@brief Opens a crate layer with a readahead hint learned from the previous opens of the same file.
+@details The usdc reader already memory-maps the file and only decodes a value when it is
+		 first accessed, so a workload touching a few attributes only pulls a few pages in.
+		 This opener records which pages of the file a workload touched (the pages resident
+		 in the page cache once the workload is done, after evicting the file before the
+		 open) into a profile next to the file. The next opens hand the recorded ranges to the
+		 kernel as readahead hints before the stage is opened, instead of faulting them in
+		 one by one over a slow mount. The profile starts with the size and modification time
+		 of the file it was recorded on, a profile of another version of the file is recorded
+		 again.
+		 The recorded pages include the ones the kernel read ahead around the faults of the
+		 workload. The crate reader maps the file through its own descriptor, so readahead
+		 cannot be turned off for it from here; replaying the profile brings in the same pages.
+		 Page faults, bytes read from the storage and the time to the first query are
+		 reported for both kinds of opens. The hints and statistics are Linux only, on other
+		 systems the stage is opened as usual.
+*/
+class PrefetchingCrateOpener
+{
+public:
+	struct Statistics
+	{
+		bool usedProfile = false;
+		size_t prefetchedBytes = 0;
+		double openSeconds = 0.;
+		double firstQuerySeconds = 0.; //!< from the start of the open to the end of the first query
+		long minorPageFaults = 0;
+		long majorPageFaults = 0;
+		long long bytesRead = 0;
+	};
+
+	explicit PrefetchingCrateOpener(const std::string& _path)
+		: m_path(_path)
+		, m_profilePath(_path + ".prefetch")
+	{
+	}
+
+	pxr::UsdStageRefPtr Open()
+	{
+		m_statistics = Statistics();
+		std::vector<std::pair<long long, long long>> ranges = ReadProfile();
+		m_statistics.usedProfile = !ranges.empty();
+		if (m_statistics.usedProfile)
+		{
+			m_statistics.prefetchedBytes = Prefetch(ranges);
+		}
+		else
+		{
+			Evict(); // so that the pages resident after the workload are the ones it touched
+		}
+
+		SampleCounters(&m_startFaults, &m_startMajorFaults, &m_startBytesRead);
+		m_start = std::chrono::steady_clock::now();
+		pxr::UsdStageRefPtr stage = pxr::UsdStage::Open(m_path);
+		m_statistics.openSeconds = SecondsSinceStart();
+		return stage;
+	}
+
+	//! To be called by the workload once its first value has been read.
+	void FirstQueryDone()
+	{
+		if (m_statistics.firstQuerySeconds == 0.)
+		{
+			m_statistics.firstQuerySeconds = SecondsSinceStart();
+		}
+	}
+
+	//! To be called once the workload is done, records the profile if there was none.
+	const Statistics& WorkloadDone()
+	{
+		long faults = 0, majorFaults = 0;
+		long long bytesRead = 0;
+		SampleCounters(&faults, &majorFaults, &bytesRead);
+		m_statistics.minorPageFaults = faults - m_startFaults;
+		m_statistics.majorPageFaults = majorFaults - m_startMajorFaults;
+		m_statistics.bytesRead = bytesRead - m_startBytesRead;
+
+		if (!m_statistics.usedProfile)
+		{
+			WriteProfile(ResidentRanges());
+		}
+		return m_statistics;
+	}
+
+private:
+	double SecondsSinceStart() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	//! The size and the modification time of the file, empty if it cannot be read.
+	std::string FileSignature() const
+	{
+		std::error_code error;
+		auto size = std::filesystem::file_size(m_path, error);
+		if (error)
+		{
+			return std::string();
+		}
+		auto modified = std::filesystem::last_write_time(m_path, error);
+		if (error)
+		{
+			return std::string();
+		}
+		return std::to_string(size) + " " + std::to_string(modified.time_since_epoch().count());
+	}
+
+	std::vector<std::pair<long long, long long>> ReadProfile() const
+	{
+		std::vector<std::pair<long long, long long>> ranges;
+		std::ifstream profile(m_profilePath);
+		std::string signature;
+		if (!std::getline(profile, signature) || signature.empty() || signature != FileSignature())
+		{
+			return ranges; // no profile, or recorded on another version of the file
+		}
+		long long offset = 0, length = 0;
+		while (profile >> offset >> length)
+		{
+			ranges.emplace_back(offset, length);
+		}
+		return ranges;
+	}
+
+	void WriteProfile(const std::vector<std::pair<long long, long long>>& _ranges) const
+	{
+		std::ofstream profile(m_profilePath);
+		profile << FileSignature() << "\n";
+		for (const auto& range : _ranges)
+		{
+			profile << range.first << " " << range.second << "\n";
+		}
+	}
+
+#ifdef __linux__
+	size_t Prefetch(const std::vector<std::pair<long long, long long>>& _ranges) const
+	{
+		int fd = open(m_path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return 0;
+		}
+		size_t bytes = 0;
+		for (const auto& range : _ranges)
+		{
+			if (posix_fadvise(fd, range.first, range.second, POSIX_FADV_WILLNEED) == 0)
+			{
+				bytes += range.second;
+			}
+		}
+		close(fd);
+		return bytes;
+	}
+
+	void Evict() const
+	{
+		int fd = open(m_path.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			// dirty pages are not dropped, e.g. when the file has just been written
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+
+	std::vector<std::pair<long long, long long>> ResidentRanges() const
+	{
+		std::vector<std::pair<long long, long long>> ranges;
+		int fd = open(m_path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return ranges;
+		}
+		struct stat status;
+		if (fstat(fd, &status) == 0 && status.st_size > 0)
+		{
+			// Mapping the file does not touch it, mincore() only reports what is in the page cache.
+			size_t size = static_cast<size_t>(status.st_size);
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (mapping != MAP_FAILED)
+			{
+				long long pageSize = sysconf(_SC_PAGESIZE);
+				std::vector<unsigned char> resident((size + pageSize - 1) / pageSize);
+				if (mincore(mapping, size, resident.data()) == 0)
+				{
+					for (size_t page = 0; page < resident.size(); ++page)
+					{
+						if (!(resident[page] & 1))
+						{
+							continue;
+						}
+						long long offset = page * pageSize;
+						if (!ranges.empty() && ranges.back().first + ranges.back().second == offset)
+						{
+							ranges.back().second += pageSize;
+						}
+						else
+						{
+							ranges.emplace_back(offset, pageSize);
+						}
+					}
+				}
+				munmap(mapping, size);
+			}
+		}
+		close(fd);
+		return ranges;
+	}
+
+	static void SampleCounters(long* _faults, long* _majorFaults, long long* _bytesRead)
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		*_faults = usage.ru_minflt;
+		*_majorFaults = usage.ru_majflt;
+
+		// read_bytes counts what actually came from the storage, page faults of mapped files included.
+		*_bytesRead = 0;
+		std::ifstream io("/proc/self/io");
+		std::string key;
+		long long value = 0;
+		while (io >> key >> value)
+		{
+			if (key == "read_bytes:")
+			{
+				*_bytesRead = value;
+			}
+		}
+	}
+#else
+	size_t Prefetch(const std::vector<std::pair<long long, long long>>&) const { return 0; }
+	void Evict() const {}
+	std::vector<std::pair<long long, long long>> ResidentRanges() const { return {}; }
+	static void SampleCounters(long* _faults, long* _majorFaults, long long* _bytesRead)
+	{
+		*_faults = *_majorFaults = 0;
+		*_bytesRead = 0;
+	}
+#endif
+
+	std::string m_path;
+	std::string m_profilePath;
+	Statistics m_statistics;
+	std::chrono::steady_clock::time_point m_start;
+	long m_startFaults = 0;
+	long m_startMajorFaults = 0;
+	long long m_startBytesRead = 0;
+};
+
+/*!
+@brief Reopens the crate file of the simple shading tutorial twice with the PrefetchingCrateOpener.
+@details The first open records which pages reading the card mesh touches, the second one
+		 prefetches them. The stages opened in the other tutorial steps are text files, which
+		 are parsed completely when opened, so only simpleShading.usd benefits from it.
+*/
+void TestFunction_PrefetchingCrateOpen()
+{
+	std::cout << "** TestFunction_PrefetchingCrateOpen **" << std::endl;
+
+	for (int run = 0; run < 2; ++run)
+	{
+		PrefetchingCrateOpener opener("simpleShading.usd");
+		pxr::UsdStageRefPtr stage = opener.Open();
+		pxr::UsdGeomMesh card(stage->GetPrimAtPath(pxr::SdfPath("/TexModel/card")));
+
+		pxr::VtVec3fArray points;
+		card.GetPointsAttr().Get(&points);
+		opener.FirstQueryDone();
+
+		pxr::VtVec2fArray st;
+		pxr::UsdGeomPrimvarsAPI(card).GetPrimvar(_authoringTokens->st).Get(&st);
+
+		const PrefetchingCrateOpener::Statistics& statistics = opener.WorkloadDone();
+		std::cout << (statistics.usedProfile ? "Open with prefetch profile" : "Open recording the prefetch profile")
+			<< ": prefetched " << statistics.prefetchedBytes << " bytes"
+			<< ", open " << statistics.openSeconds << " s"
+			<< ", first query after " << statistics.firstQuerySeconds << " s"
+			<< ", page faults " << statistics.minorPageFaults << " minor / " << statistics.majorPageFaults << " major"
+			<< ", " << statistics.bytesRead << " bytes read" << std::endl;
+	}
+}
+
+/*!
+@brief A layer cache shared by all the processes of a host, for worker farms opening the same assets.
+@details The first process opening a layer publishes it as a crate file in a shared memory
+		 directory (/dev/shm on Linux), under a key made of the identity of the source file
+		 (device, inode, path) and of its version (modification time and size). Publishing a
+		 new version of a file removes the copies of its older versions, a process which still
+		 maps one keeps reading it until it closes the layer. The other processes open the
+		 published crate instead of parsing the source: the crate reader maps it read-only, so
+		 the values are shared through the page cache and only decoded where they are used.
+		 The asset paths of a published layer are made absolute, and the ones pointing to other
+		 layers (sublayers, references, payloads) are redirected to the published copies of
+		 these layers. The keys of these dependencies are stored in the custom layer data of
+		 the published layer, and checked again whenever it is found in the cache.
+		 Publishing writes a temporary file first and renames it, so a reader never sees a
+		 partially written layer.
+*/
+class SharedLayerCache
+{
+public:
+	explicit SharedLayerCache(const std::string& _directory = DefaultDirectory())
+		: m_directory(_directory)
+	{
+		std::error_code ignored;
+		std::filesystem::create_directories(m_directory, ignored);
+	}
+
+	/*!
+	@return The shared copy of the layer at _path, published if needed, or a null layer.
+	*/
+	pxr::SdfLayerRefPtr Open(const std::string& _path)
+	{
+		std::set<std::string> visiting;
+		std::string cachePath = Publish(_path, visiting);
+		return cachePath.empty() ? pxr::SdfLayerRefPtr() : pxr::SdfLayer::FindOrOpen(cachePath);
+	}
+
+	static std::string DefaultDirectory()
+	{
+#ifdef __linux__
+		return "/dev/shm/usdLayerCache";
+#else
+		return (std::filesystem::temp_directory_path() / "usdLayerCache").string();
+#endif
+	}
+
+private:
+	static std::string Canonical(const std::string& _path)
+	{
+		std::error_code error;
+		std::string canonical = std::filesystem::canonical(_path, error).string();
+		return error ? std::string() : canonical;
+	}
+
+	static std::string ComputeKey(const std::string& _path)
+	{
+		std::string canonical = Canonical(_path);
+		if (canonical.empty())
+		{
+			return std::string();
+		}
+		size_t identity = std::hash<std::string>()(canonical);
+		size_t version = 0;
+		auto combine = [](size_t& _key, unsigned long long _value)
+		{
+			_key ^= std::hash<unsigned long long>()(_value) + 0x9e3779b97f4a7c15ull + (_key << 6) + (_key >> 2);
+		};
+#ifdef _WIN32
+		std::error_code error;
+		auto size = std::filesystem::file_size(canonical, error);
+		if (error)
+		{
+			return std::string();
+		}
+		auto modified = std::filesystem::last_write_time(canonical, error);
+		if (error)
+		{
+			return std::string();
+		}
+		combine(version, size);
+		combine(version, modified.time_since_epoch().count());
+#else
+		struct stat status;
+		if (stat(canonical.c_str(), &status) != 0)
+		{
+			return std::string();
+		}
+		combine(identity, status.st_dev);
+		combine(identity, status.st_ino);
+		combine(version, status.st_size);
+		combine(version, status.st_mtime);
+#ifdef __linux__
+		combine(version, status.st_mtim.tv_nsec);
+#endif
+#endif
+		std::ostringstream hex;
+		hex << std::hex << identity << '-' << version;
+		return hex.str();
+	}
+
+	//! Removes the published copies of the other versions of the file of _key.
+	void RemoveOtherVersions(const std::string& _key) const
+	{
+		const std::string identity = _key.substr(0, _key.find('-') + 1);
+		std::error_code error;
+		for (const auto& entry : std::filesystem::directory_iterator(m_directory, error))
+		{
+			// the temporary files of the processes publishing right now have a dot in their stem
+			std::string stem = entry.path().stem().string();
+			if (entry.path().extension() == ".usdc" && stem != _key && stem.compare(0, identity.size(), identity) == 0
+				&& stem.find('.') == std::string::npos)
+			{
+				std::error_code ignored;
+				std::filesystem::remove(entry.path(), ignored);
+			}
+		}
+	}
+
+	std::string CachePathForKey(const std::string& _key) const
+	{
+		return (std::filesystem::path(m_directory) / (_key + ".usdc")).string();
+	}
+
+	//! True if the layers the published layer depends on have not changed since it was published.
+	bool IsUpToDate(const std::string& _cachePath, std::set<std::string>& _visiting) const
+	{
+		pxr::SdfLayerRefPtr published = pxr::SdfLayer::FindOrOpen(_cachePath);
+		if (!published)
+		{
+			return false;
+		}
+		pxr::VtDictionary customLayerData = published->GetCustomLayerData();
+		const pxr::VtValue* dependencies = customLayerData.GetValueAtPath(DependenciesKey());
+		if (!dependencies || !dependencies->IsHolding<pxr::VtDictionary>())
+		{
+			return true;
+		}
+		for (const auto& dependency : dependencies->UncheckedGet<pxr::VtDictionary>())
+		{
+			std::string key = ComputeKey(dependency.first);
+			if (key.empty() || !dependency.second.IsHolding<std::string>() || key != dependency.second.UncheckedGet<std::string>())
+			{
+				return false;
+			}
+			if (_visiting.insert(dependency.first).second)
+			{
+				bool upToDate = IsUpToDate(CachePathForKey(key), _visiting);
+				_visiting.erase(dependency.first);
+				if (!upToDate)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/*!
+	@brief Returns the path of the published copy of the layer at _path, or an empty string.
+	@details _visiting holds the canonical paths of the layers being published, to break cycles.
+	*/
+	std::string Publish(const std::string& _path, std::set<std::string>& _visiting)
+	{
+		std::string path = Canonical(_path);
+		std::string key = ComputeKey(path);
+		if (key.empty())
+		{
+			return std::string();
+		}
+		std::string cachePath = CachePathForKey(key);
+		_visiting.insert(path);
+		if (std::filesystem::exists(cachePath) && IsUpToDate(cachePath, _visiting))
+		{
+			_visiting.erase(path);
+			return cachePath;
+		}
+
+		pxr::SdfLayerRefPtr source = pxr::SdfLayer::FindOrOpen(path);
+		if (!source)
+		{
+			_visiting.erase(path);
+			return std::string();
+		}
+		pxr::SdfLayerRefPtr copy = pxr::SdfLayer::CreateAnonymous();
+		copy->TransferContent(source);
+
+		pxr::VtDictionary dependencies;
+		pxr::UsdUtilsModifyAssetPaths(copy, [&](const std::string& _assetPath)
+		{
+			if (_assetPath.empty())
+			{
+				return _assetPath;
+			}
+			std::string anchored = pxr::SdfComputeAssetPathRelativeToLayer(source, _assetPath);
+			std::string canonical = Canonical(anchored);
+			if (canonical.empty() || !pxr::SdfFileFormat::FindByExtension(anchored) || _visiting.count(canonical))
+			{
+				return anchored; // not a layer (e.g. a texture), or a cycle
+			}
+			std::string dependency = Publish(canonical, _visiting);
+			if (dependency.empty())
+			{
+				return anchored;
+			}
+			dependencies[canonical] = pxr::VtValue(ComputeKey(canonical));
+			return dependency;
+		});
+		_visiting.erase(path);
+
+		pxr::VtDictionary customLayerData = copy->GetCustomLayerData();
+		customLayerData.SetValueAtPath(DependenciesKey(), pxr::VtValue(dependencies));
+		copy->SetCustomLayerData(customLayerData);
+
+		std::string temporary = (std::filesystem::path(m_directory) / (key + "." + std::to_string(ProcessId()) + ".usdc")).string();
+		std::error_code error;
+		if (!copy->Export(temporary))
+		{
+			std::filesystem::remove(temporary, error);
+			return std::string();
+		}
+		// Another process publishing the same layer at the same time wrote the same content.
+		std::filesystem::rename(temporary, cachePath, error);
+		if (error)
+		{
+			return std::string();
+		}
+		RemoveOtherVersions(key);
+		return cachePath;
+	}
+
+	static const std::string& DependenciesKey()
+	{
+		static const std::string key("sharedLayerCache:dependencies");
+		return key;
+	}
+
+	static long ProcessId()
+	{
+#ifdef _WIN32
+		return _getpid();
+#else
+		return getpid();
+#endif
+	}
+
+	std::string m_directory;
+};
+
+#ifdef __linux__
+/*!
+@brief Reads the resident set size and the proportional set size of the process, in kB.
+@details The shared pages count fully in the RSS of every process but are split between them in the PSS.
+*/
+void ReadProcessMemory(long long* _rssKB, long long* _pssKB)
+{
+	*_rssKB = *_pssKB = 0;
+	std::ifstream rollup("/proc/self/smaps_rollup");
+	std::string line;
+	while (std::getline(rollup, line))
+	{
+		std::istringstream fields(line);
+		std::string key;
+		long long value = 0;
+		fields >> key >> value;
+		if (key == "Rss:")
+		{
+			*_rssKB = value;
+		}
+		else if (key == "Pss:")
+		{
+			*_pssKB = value;
+		}
+	}
+}
+
+/*!
+@brief The worker process of TestFunction_SharedLayerCache.
+@details Opens and composes the stage, shared or not, writes "latency rss pss" to stdout and
+		 stays alive until its stdin is closed, so that all the workers are alive when measured.
+*/
+int RunSharedLayerCacheWorker(const std::string& _mode, const std::string& _path)
+{
+	auto start = std::chrono::steady_clock::now();
+	pxr::UsdStageRefPtr stage;
+	if (_mode == "shared")
+	{
+		SharedLayerCache cache;
+		pxr::SdfLayerRefPtr rootLayer = cache.Open(_path);
+		stage = rootLayer ? pxr::UsdStage::Open(rootLayer) : pxr::UsdStageRefPtr();
+	}
+	else
+	{
+		stage = pxr::UsdStage::Open(_path);
+	}
+	if (!stage)
+	{
+		return 1;
+	}
+	for (pxr::UsdPrim prim : stage->TraverseAll())
+	{
+		(void)prim; // compose everything
+	}
+	double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	long long rssKB = 0, pssKB = 0;
+	ReadProcessMemory(&rssKB, &pssKB);
+	std::cout << latency << " " << rssKB << " " << pssKB << std::endl;
+
+	std::string untilClosed;
+	std::getline(std::cin, untilClosed);
+	return 0;
+}
+
+/*!
+@brief Runs _count workers opening _path, shared or not, and prints their total memory and mean open latency.
+*/
+void RunSharedLayerCacheWorkers(const std::string& _mode, const std::string& _path, int _count)
+{
+	struct Worker
+	{
+		pid_t pid = -1;
+		int input = -1;
+		int output = -1;
+	};
+	std::vector<Worker> workers;
+
+	for (int i = 0; i < _count; ++i)
+	{
+		// Close-on-exec, so that the later workers do not inherit the ends of the pipes of the
+		// earlier ones: a worker only sees the end of its input once every copy is closed.
+		int input[2], output[2];
+		if (pipe2(input, O_CLOEXEC) != 0)
+		{
+			break;
+		}
+		if (pipe2(output, O_CLOEXEC) != 0)
+		{
+			close(input[0]);
+			close(input[1]);
+			break;
+		}
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+
+		std::string executable = "/proc/self/exe";
+		std::string option = "--shared-layer-cache-worker";
+		std::string mode = _mode;
+		std::string path = _path;
+		char* arguments[] = { &executable[0], &option[0], &mode[0], &path[0], nullptr };
+
+		Worker worker;
+		int spawned = posix_spawn(&worker.pid, executable.c_str(), &actions, nullptr, arguments, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		close(input[0]);
+		close(output[1]);
+		if (spawned != 0)
+		{
+			close(input[1]);
+			close(output[0]);
+			break;
+		}
+		worker.input = input[1];
+		worker.output = output[0];
+		workers.push_back(worker);
+	}
+
+	double totalLatency = 0.;
+	long long totalRssKB = 0, totalPssKB = 0;
+	int reported = 0;
+	for (const Worker& worker : workers)
+	{
+		std::string line;
+		char c;
+		while (read(worker.output, &c, 1) == 1 && c != '\n')
+		{
+			line += c;
+		}
+		std::istringstream fields(line);
+		double latency = 0.;
+		long long rssKB = 0, pssKB = 0;
+		if (fields >> latency >> rssKB >> pssKB)
+		{
+			totalLatency += latency;
+			totalRssKB += rssKB;
+			totalPssKB += pssKB;
+			++reported;
+		}
+	}
+	for (const Worker& worker : workers)
+	{
+		close(worker.input); // lets the worker exit
+		close(worker.output);
+	}
+	for (const Worker& worker : workers)
+	{
+		int status = 0;
+		waitpid(worker.pid, &status, 0);
+	}
+
+	std::cout << _count << " workers, " << _mode << " layers: " << reported << " reported"
+		<< ", mean open latency " << (reported ? totalLatency / reported : 0.) << " s"
+		<< ", total RSS " << totalRssKB << " kB, total PSS " << totalPssKB << " kB" << std::endl;
+}
+#endif
+
+/*!
+@brief Compares the memory and open latency of worker processes opening the same stage, with and without the SharedLayerCache.
+@details Step6.usda is used since it references Step5.usda three times, which itself references top.geom.usd.
+*/
+void TestFunction_SharedLayerCache()
+{
+	std::cout << "** TestFunction_SharedLayerCache **" << std::endl;
+
+#ifdef __linux__
+	const int workerCount = 8;
+
+	// Publishing happens once, before the workers are started, so that all of them find the cache.
+	SharedLayerCache cache;
+	if (!cache.Open("Step6.usda"))
+	{
+		std::cout << "Step6.usda could not be published in " << SharedLayerCache::DefaultDirectory() << std::endl;
+		return;
+	}
+
+	RunSharedLayerCacheWorkers("private", "Step6.usda", workerCount);
+	RunSharedLayerCacheWorkers("shared", "Step6.usda", workerCount);
+#else
+	std::cout << "The worker processes of this test are only implemented for Linux." << std::endl;
+#endif
+}
+
+/*!
+@brief Returns the bytes allocated on the heap of the process, for the authoring benchmark.
+@details Read from the statistics of the glibc allocator, -1 where they are not available. The
+		 difference around a workload is the memory it allocated and still holds, the
+		 allocations of the other threads running meanwhile included.
+*/
+long long HeapBytesInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	return static_cast<long long>(info.uordblks + info.hblkhd);
+#else
+	return -1;
+#endif
+}
+
+/*!
+@brief A scoped session sharing the values and the names built by bulk authoring code.
+@details The values handed over to USD (VtArrays, tokens, paths) must own their memory since the
+		 layers keep them after the session, and VtArray cannot take an allocator, so the
+		 authoring code has no temporaries an arena could serve. The session avoids building the
+		 same values over and over instead: a value many prims get is built once and shared with
+		 SharedArray(), a VtArray copy only adds a reference to the same buffer, and names are
+		 formatted on the stack and turned into a token directly, without a string temporary.
+		 Tokens come from the token table of the tutorials, and the numbered child paths of a
+		 parent are built once per session into a table by ChildPaths(), from the parent path
+		 and a token, which does not parse a path string.
+		 A session is used by one thread, each thread authoring in parallel opens its own.
+*/
+class AuthoringSession
+{
+public:
+	//! The token _prefix followed by _index, _prefix is cut to 40 characters.
+	static pxr::TfToken MakeName(const char* _prefix, size_t _index)
+	{
+		char name[64];
+		size_t length = std::min(std::strlen(_prefix), size_t(40));
+		std::memcpy(name, _prefix, length);
+		std::to_chars_result end = std::to_chars(name + length, name + sizeof(name) - 1, _index);
+		*end.ptr = '\0';
+		return pxr::TfToken(name);
+	}
+
+	//! The paths of the children of _parent named _prefix followed by 0 to _count - 1, built on the first call.
+	const std::vector<pxr::SdfPath>& ChildPaths(const pxr::SdfPath& _parent, const char* _prefix, size_t _count)
+	{
+		std::vector<pxr::SdfPath>& paths = m_childPaths[{ _parent, _prefix }];
+		for (size_t index = paths.size(); index < _count; ++index)
+		{
+			paths.push_back(_parent.AppendChild(MakeName(_prefix, index)));
+		}
+		return paths;
+	}
+
+	/*!
+	@brief Returns the array registered under _key in this session, building it with _build the first time.
+	*/
+	template <typename T>
+	const pxr::VtArray<T>& SharedArray(const std::string& _key, const std::function<pxr::VtArray<T>()>& _build)
+	{
+		pxr::VtValue& value = m_sharedArrays[_key];
+		if (value.IsEmpty())
+		{
+			value = _build();
+		}
+		return value.UncheckedGet<pxr::VtArray<T>>();
+	}
+
+private:
+	std::map<std::string, pxr::VtValue> m_sharedArrays;
+	std::map<std::pair<pxr::SdfPath, std::string>, std::vector<pxr::SdfPath>> m_childPaths;
+};
+
+/*!
+@brief Compares bulk authoring with and without an AuthoringSession, in heap bytes and prims per second.
+@details The workload defines many animated xforms, each holding a sphere whose radius, extent and
+		 display color are authored, the way the tutorials author a single one.
+*/
+void TestFunction_BulkAuthoringBenchmark()
+{
+	std::cout << "** TestFunction_BulkAuthoringBenchmark **" << std::endl;
+
+	const size_t primCount = 5000;
+
+	// The way the tutorial functions author, strings turned into tokens and paths on every call.
+	auto authorPlain = [primCount](pxr::UsdStageRefPtr _stage)
+	{
+		for (size_t i = 0; i < primCount; ++i)
+		{
+			std::string path = "/Bulk_" + std::to_string(i);
+			pxr::UsdGeomXform xform = pxr::UsdGeomXform::Define(_stage, pxr::SdfPath(path));
+			pxr::UsdGeomXformOp spin = xform.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, pxr::TfToken("spin"));
+			spin.Set(0.f, 1.f);
+			spin.Set(1440.f, 192.f);
+
+			pxr::UsdGeomSphere sphere = pxr::UsdGeomSphere::Define(_stage, pxr::SdfPath(path + "/ball"));
+			float radius = 1.f + (i % 10);
+			sphere.GetPrim().GetAttribute(pxr::TfToken("radius")).Set(double(radius));
+			sphere.GetPrim().GetAttribute(pxr::TfToken("extent")).Set(pxr::VtVec3fArray({ pxr::GfVec3f(-radius), pxr::GfVec3f(radius) }));
+			sphere.GetDisplayColorAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) }));
+		}
+	};
+
+	auto authorInSession = [primCount](pxr::UsdStageRefPtr _stage)
+	{
+		AuthoringSession session;
+		const pxr::TfToken ball("ball");
+		const std::vector<pxr::SdfPath>& paths = session.ChildPaths(pxr::SdfPath::AbsoluteRootPath(), "Bulk_", primCount);
+		const pxr::VtVec3fArray& blue = session.SharedArray<pxr::GfVec3f>("blue", []()
+		{
+			return pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) });
+		});
+
+		for (size_t i = 0; i < primCount; ++i)
+		{
+			const pxr::SdfPath& path = paths[i];
+			pxr::UsdGeomXform xform = pxr::UsdGeomXform::Define(_stage, path);
+			pxr::UsdGeomXformOp spin = xform.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->spin);
+			spin.Set(0.f, 1.f);
+			spin.Set(1440.f, 192.f);
+
+			pxr::UsdGeomSphere sphere = pxr::UsdGeomSphere::Define(_stage, path.AppendChild(ball));
+			float radius = 1.f + (i % 10);
+			sphere.GetPrim().GetAttribute(_authoringTokens->radius).Set(double(radius));
+			pxr::VtVec3fArray extent(2);
+			extent[0] = pxr::GfVec3f(-radius);
+			extent[1] = pxr::GfVec3f(radius);
+			sphere.GetPrim().GetAttribute(_authoringTokens->extent).Set(extent);
+			sphere.GetDisplayColorAttr().Set(blue);
+		}
+	};
+
+	auto measure = [primCount](const char* _label, const std::function<void(pxr::UsdStageRefPtr)>& _author)
+	{
+		pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateInMemory();
+		long long heapBytes = HeapBytesInUse();
+		auto start = std::chrono::steady_clock::now();
+		_author(stage);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << _label << ": ";
+		if (heapBytes >= 0)
+		{
+			heapBytes = HeapBytesInUse() - heapBytes;
+			std::cout << heapBytes << " heap bytes held (" << double(heapBytes) / primCount << " per prim), ";
+		}
+		std::cout << primCount / seconds << " prims/s" << std::endl;
+	};
+
+	measure("Plain authoring", authorPlain);
+	measure("Authoring session", authorInSession);
+}
+
+/*!
+@brief Triangulates meshes and packs them into flat interleaved buffers, ready to upload to the GPU.
+@details Faces are triangulated as fans, which is exact for the convex faces meshes are made of,
+		 and left handed faces are flipped so that all the triangles are counter clockwise.
+		 The triangulation of a topology (face vertex counts, face vertex indices and orientation)
+		 is cached under a hash of its arrays and shared by all the meshes and frames with the
+		 same topology, only the vertex buffer is packed again.
+		 Faces, vertices and indices are processed in parallel chunks. The interpolation of the
+		 primvar is resolved once per chunk into a dedicated loop, so that the inner loops are
+		 branch free and can be vectorized by the compiler where they read contiguous arrays.
+		 A vertex is emitted per point when the primvar (st) is vertex, varying or constant, and
+		 per face-vertex when it is faceVarying or uniform.
+*/
+class MeshPacker
+{
+public:
+	//! What is read from a UsdGeomMesh at a given time.
+	struct MeshSource
+	{
+		pxr::VtIntArray faceVertexCounts;
+		pxr::VtIntArray faceVertexIndices;
+		pxr::VtVec3fArray points;
+		pxr::VtVec2fArray st;              //!< flattened, empty if the mesh has no such primvar
+		pxr::TfToken stInterpolation;
+		bool leftHanded = false;
+	};
+
+	struct RenderBuffers
+	{
+		std::vector<float> vertices;       //!< x, y, z then s, t if there is a primvar, for each vertex
+		std::vector<uint32_t> indices;     //!< three per triangle, counter clockwise
+		size_t vertexStride = 3;           //!< in floats
+		size_t vertexCount = 0;
+		size_t triangleCount = 0;
+	};
+
+	//! The triangles of a topology, as face-vertices (indices into faceVertexIndices).
+	struct Triangulation
+	{
+		std::vector<uint32_t> corners;          //!< three face-vertices per triangle
+		std::vector<uint32_t> faceOfFaceVertex; //!< for the uniform primvars
+	};
+
+	static bool Read(const pxr::UsdGeomMesh& _mesh, pxr::UsdTimeCode _time, const pxr::TfToken& _primvarName, MeshSource* _source)
+	{
+		pxr::TfToken orientation;
+		if (!_mesh.GetFaceVertexCountsAttr().Get(&_source->faceVertexCounts, _time)
+			|| !_mesh.GetFaceVertexIndicesAttr().Get(&_source->faceVertexIndices, _time)
+			|| !_mesh.GetPointsAttr().Get(&_source->points, _time))
+		{
+			return false;
+		}
+		_mesh.GetOrientationAttr().Get(&orientation, _time);
+		_source->leftHanded = (orientation == pxr::UsdGeomTokens->leftHanded);
+
+		_source->st.clear();
+		_source->stInterpolation = pxr::TfToken();
+		pxr::UsdGeomPrimvar primvar = pxr::UsdGeomPrimvarsAPI(_mesh).GetPrimvar(_primvarName);
+		if (primvar && primvar.ComputeFlattened(&_source->st, _time))
+		{
+			_source->stInterpolation = primvar.GetInterpolation();
+		}
+		return true;
+	}
+
+	/*!
+	@return The triangulation of the topology, from the cache if it has already been seen, nullptr if the topology is invalid.
+	*/
+	std::shared_ptr<const Triangulation> Triangulate(const pxr::VtIntArray& _counts, const pxr::VtIntArray& _indices, bool _leftHanded)
+	{
+		size_t hash = HashTopology(_counts, _indices, _leftHanded);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto range = m_topologies.equal_range(hash);
+			for (auto entry = range.first; entry != range.second; ++entry)
+			{
+				if (entry->second.leftHanded == _leftHanded && entry->second.counts == _counts && entry->second.indices == _indices)
+				{
+					return entry->second.triangulation;
+				}
+			}
+		}
+
+		std::shared_ptr<const Triangulation> triangulation = ComputeTriangulation(_counts, _indices, _leftHanded);
+		if (triangulation)
+		{
+			// VtArray copies share the buffers of the mesh, keeping them costs no copy.
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_topologies.emplace(hash, Topology{ _counts, _indices, _leftHanded, triangulation });
+		}
+		return triangulation;
+	}
+
+	bool Pack(const MeshSource& _source, RenderBuffers* _buffers)
+	{
+		std::shared_ptr<const Triangulation> triangulation = Triangulate(_source.faceVertexCounts, _source.faceVertexIndices, _source.leftHanded);
+		if (!triangulation)
+		{
+			return false;
+		}
+
+		const pxr::TfToken& interpolation = _source.stInterpolation;
+		const bool perFaceVertex = interpolation == pxr::UsdGeomTokens->faceVarying || interpolation == pxr::UsdGeomTokens->uniform;
+		const size_t faceVertexCount = _source.faceVertexIndices.size();
+		const size_t pointCount = _source.points.size();
+		const int* faceVertexIndices = _source.faceVertexIndices.cdata();
+		if (!std::all_of(faceVertexIndices, faceVertexIndices + faceVertexCount,
+			[pointCount](int _index) { return _index >= 0 && size_t(_index) < pointCount; }))
+		{
+			return false;
+		}
+
+		size_t expectedStCount = interpolation == pxr::UsdGeomTokens->faceVarying ? faceVertexCount
+			: interpolation == pxr::UsdGeomTokens->uniform ? _source.faceVertexCounts.size()
+			: interpolation == pxr::UsdGeomTokens->constant ? 1 : pointCount;
+		const bool hasSt = !_source.st.empty() && _source.st.size() >= expectedStCount;
+
+		_buffers->vertexStride = hasSt ? 5 : 3;
+		_buffers->vertexCount = perFaceVertex ? faceVertexCount : pointCount;
+		_buffers->triangleCount = triangulation->corners.size() / 3;
+		_buffers->vertices.resize(_buffers->vertexCount * _buffers->vertexStride);
+		_buffers->indices.resize(triangulation->corners.size());
+
+		const pxr::GfVec3f* points = _source.points.cdata();
+		const pxr::GfVec2f* st = _source.st.cdata();
+		float* vertices = _buffers->vertices.data();
+		const size_t stride = _buffers->vertexStride;
+		const uint32_t* faceOfFaceVertex = triangulation->faceOfFaceVertex.data();
+		enum class StSource { None, PerVertex, PerFace, Constant };
+		const StSource stSource = !hasSt ? StSource::None
+			: interpolation == pxr::UsdGeomTokens->uniform ? StSource::PerFace
+			: interpolation == pxr::UsdGeomTokens->constant ? StSource::Constant : StSource::PerVertex;
+		pxr::WorkParallelForN(_buffers->vertexCount, [&](size_t _begin, size_t _end)
+		{
+			if (perFaceVertex)
+			{
+				for (size_t vertex = _begin; vertex < _end; ++vertex)
+				{
+					const pxr::GfVec3f& point = points[faceVertexIndices[vertex]];
+					float* out = vertices + vertex * stride;
+					out[0] = point[0];
+					out[1] = point[1];
+					out[2] = point[2];
+				}
+			}
+			else
+			{
+				for (size_t vertex = _begin; vertex < _end; ++vertex)
+				{
+					float* out = vertices + vertex * stride;
+					out[0] = points[vertex][0];
+					out[1] = points[vertex][1];
+					out[2] = points[vertex][2];
+				}
+			}
+
+			switch (stSource)
+			{
+			case StSource::PerVertex:
+				for (size_t vertex = _begin; vertex < _end; ++vertex)
+				{
+					vertices[vertex * stride + 3] = st[vertex][0];
+					vertices[vertex * stride + 4] = st[vertex][1];
+				}
+				break;
+			case StSource::PerFace:
+				for (size_t vertex = _begin; vertex < _end; ++vertex)
+				{
+					vertices[vertex * stride + 3] = st[faceOfFaceVertex[vertex]][0];
+					vertices[vertex * stride + 4] = st[faceOfFaceVertex[vertex]][1];
+				}
+				break;
+			case StSource::Constant:
+				for (size_t vertex = _begin; vertex < _end; ++vertex)
+				{
+					vertices[vertex * stride + 3] = st[0][0];
+					vertices[vertex * stride + 4] = st[0][1];
+				}
+				break;
+			default:
+				break;
+			}
+		});
+
+		const uint32_t* corners = triangulation->corners.data();
+		uint32_t* indices = _buffers->indices.data();
+		if (perFaceVertex)
+		{
+			std::copy(corners, corners + triangulation->corners.size(), indices);
+		}
+		else
+		{
+			pxr::WorkParallelForN(triangulation->corners.size(), [&](size_t _begin, size_t _end)
+			{
+				for (size_t corner = _begin; corner < _end; ++corner)
+				{
+					indices[corner] = static_cast<uint32_t>(faceVertexIndices[corners[corner]]);
+				}
+			});
+		}
+		return true;
+	}
+
+	size_t GetCachedTopologyCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_topologies.size();
+	}
+
+	//! The key of the cached topologies, also used by MeshDerivatives.
+	static size_t HashTopology(const pxr::VtIntArray& _counts, const pxr::VtIntArray& _indices, bool _leftHanded)
+	{
+		std::hash<std::string_view> hashBytes;
+		size_t hash = hashBytes(std::string_view(reinterpret_cast<const char*>(_counts.cdata()), _counts.size() * sizeof(int)));
+		hash ^= hashBytes(std::string_view(reinterpret_cast<const char*>(_indices.cdata()), _indices.size() * sizeof(int)))
+			+ 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+		return _leftHanded ? ~hash : hash;
+	}
+
+private:
+	struct Topology
+	{
+		pxr::VtIntArray counts;
+		pxr::VtIntArray indices;
+		bool leftHanded;
+		std::shared_ptr<const Triangulation> triangulation;
+	};
+
+	static std::shared_ptr<const Triangulation> ComputeTriangulation(const pxr::VtIntArray& _counts, const pxr::VtIntArray& _indices, bool _leftHanded)
+	{
+		// The prefix sums give every face its first face-vertex and its first triangle.
+		const size_t faceCount = _counts.size();
+		const int* counts = _counts.cdata();
+		std::vector<uint32_t> firstFaceVertex(faceCount + 1);
+		std::vector<uint32_t> firstTriangle(faceCount + 1);
+		firstFaceVertex[0] = firstTriangle[0] = 0;
+		for (size_t face = 0; face < faceCount; ++face)
+		{
+			if (counts[face] < 0)
+			{
+				return nullptr;
+			}
+			firstFaceVertex[face + 1] = firstFaceVertex[face] + counts[face];
+			firstTriangle[face + 1] = firstTriangle[face] + (counts[face] > 2 ? counts[face] - 2 : 0);
+		}
+		if (firstFaceVertex[faceCount] != _indices.size())
+		{
+			return nullptr;
+		}
+
+		auto triangulation = std::make_shared<Triangulation>();
+		triangulation->corners.resize(3 * size_t(firstTriangle[faceCount]));
+		triangulation->faceOfFaceVertex.resize(_indices.size());
+		uint32_t* corners = triangulation->corners.data();
+		uint32_t* faceOfFaceVertex = triangulation->faceOfFaceVertex.data();
+		pxr::WorkParallelForN(faceCount, [&](size_t _begin, size_t _end)
+		{
+			for (size_t face = _begin; face < _end; ++face)
+			{
+				const uint32_t first = firstFaceVertex[face];
+				const uint32_t count = counts[face];
+				std::fill(faceOfFaceVertex + first, faceOfFaceVertex + first + count, static_cast<uint32_t>(face));
+
+				uint32_t* out = corners + 3 * size_t(firstTriangle[face]);
+				for (uint32_t k = 1; k + 1 < count; ++k, out += 3)
+				{
+					out[0] = first;
+					out[1] = first + (_leftHanded ? k + 1 : k);
+					out[2] = first + (_leftHanded ? k : k + 1);
+				}
+			}
+		});
+		return triangulation;
+	}
+
+	mutable std::mutex m_mutex;
+	std::unordered_multimap<size_t, Topology> m_topologies;
+};
+
+/*!
+@brief A mixed quad and hexagon grid with face-varying st, the kind of topology the viewer converts.
+*/
+MeshPacker::MeshSource MakeBenchmarkGrid(int _width, int _height)
+{
+	MeshPacker::MeshSource grid;
+	grid.points.reserve(size_t(_width + 1) * (_height + 1));
+	for (int y = 0; y <= _height; ++y)
+	{
+		for (int x = 0; x <= _width; ++x)
+		{
+			grid.points.push_back(pxr::GfVec3f(float(x), float(y), 0.f));
+		}
+	}
+
+	auto point = [_width](int _x, int _y) { return _y * (_width + 1) + _x; };
+	auto addCorner = [&](int _x, int _y)
+	{
+		grid.faceVertexIndices.push_back(point(_x, _y));
+		grid.st.push_back(pxr::GfVec2f(float(_x) / _width, float(_y) / _height));
+	};
+	for (int y = 0; y < _height; ++y)
+	{
+		for (int x = 0; x < _width; ++x)
+		{
+			if (y % 2 == 1 && x % 2 == 0 && x + 1 < _width)
+			{
+				// Two cells merged into a hexagon on odd rows.
+				addCorner(x, y); addCorner(x + 1, y); addCorner(x + 2, y);
+				addCorner(x + 2, y + 1); addCorner(x + 1, y + 1); addCorner(x, y + 1);
+				grid.faceVertexCounts.push_back(6);
+				++x;
+			}
+			else
+			{
+				addCorner(x, y); addCorner(x + 1, y); addCorner(x + 1, y + 1); addCorner(x, y + 1);
+				grid.faceVertexCounts.push_back(4);
+			}
+		}
+	}
+	grid.stInterpolation = pxr::UsdGeomTokens->faceVarying;
+	return grid;
+}
+
+/*!
+@brief Packs the card of the simple shading tutorial, then measures the packing throughput on a large n-gon mesh.
+*/
+void TestFunction_MeshPacking()
+{
+	std::cout << "** TestFunction_MeshPacking **" << std::endl;
+
+	MeshPacker packer;
+	MeshPacker::RenderBuffers buffers;
+
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::Open("simpleShading.usd");
+	pxr::UsdGeomMesh card(stage->GetPrimAtPath(pxr::SdfPath("/TexModel/card")));
+	MeshPacker::MeshSource source;
+	if (MeshPacker::Read(card, pxr::UsdTimeCode::Default(), _authoringTokens->st, &source) && packer.Pack(source, &buffers))
+	{
+		std::cout << "/TexModel/card: " << buffers.vertexCount << " vertices of " << buffers.vertexStride << " floats, indices: [";
+		for (uint32_t index : buffers.indices)
+		{
+			std::cout << index << ",";
+		}
+		std::cout << "]" << std::endl;
+	}
+
+	// The first frame triangulates the topology, the next ones reuse it like an animated mesh would.
+	MeshPacker::MeshSource grid = MakeBenchmarkGrid(1024, 1024);
+	const int frameCount = 10;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		auto start = std::chrono::steady_clock::now();
+		packer.Pack(grid, &buffers);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (frame == 0 || frame == frameCount - 1)
+		{
+			std::cout << (frame == 0 ? "New topology: " : "Cached topology: ") << buffers.triangleCount << " triangles in "
+				<< seconds << " s, " << buffers.triangleCount / seconds << " triangles/s" << std::endl;
+		}
+	}
+	std::cout << "Topologies in the cache: " << packer.GetCachedTopologyCount() << std::endl;
+}
+
+/*!
+@brief Computes smooth normals and st tangents of meshes, for deforming mesh playback.
+@details The point to face adjacency of a topology is built once and cached under the topology
+		 hash of the MeshPacker, all the meshes and frames with this topology share it.
+		 A frame is computed in two parallel passes without any locking: the area weighted
+		 normal and the st tangent frame of every face, then for every point the sum over its
+		 adjacent faces (gathered through the adjacency, so no two threads write the same
+		 point), normalized and orthogonalized. The passes are plain loops over contiguous
+		 arrays, vectorized by the compiler.
+		 The last result of every mesh is kept, a frame whose points and st did not change is
+		 not computed again.
+		 Normals are per point (vertex interpolation), tangents hold the handedness of the
+		 bitangent in w. Without st, only the normals are computed.
+*/
+class MeshDerivatives
+{
+public:
+	struct Result
+	{
+		pxr::VtVec3fArray normals;
+		pxr::VtVec4fArray tangents;
+		bool recomputed = false; //!< false when the cached result of the mesh was returned
+	};
+
+	bool Compute(const pxr::SdfPath& _mesh, const MeshPacker::MeshSource& _source, Result* _result)
+	{
+		std::shared_ptr<const Adjacency> adjacency = GetAdjacency(_source);
+		if (!adjacency)
+		{
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto cached = m_results.find(_mesh);
+			if (cached != m_results.end() && cached->second.adjacency == adjacency
+				&& cached->second.points == _source.points && cached->second.st == _source.st)
+			{
+				*_result = cached->second.result;
+				_result->recomputed = false;
+				return true;
+			}
+		}
+
+		ComputeDerivatives(*adjacency, _source, _result);
+		_result->recomputed = true;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_results[_mesh] = CachedResult{ adjacency, _source.points, _source.st, *_result };
+		return true;
+	}
+
+	size_t GetCachedTopologyCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_adjacencies.size();
+	}
+
+private:
+	//! The faces around each point, as face-vertices, in compressed rows.
+	struct Adjacency
+	{
+		pxr::VtIntArray counts;
+		pxr::VtIntArray indices;
+		bool leftHanded = false;
+		size_t pointCount = 0;
+		std::vector<uint32_t> firstFaceVertex;      //!< per face, plus the end
+		std::vector<uint32_t> faceOfFaceVertex;
+		std::vector<uint32_t> firstPointFaceVertex; //!< per point, plus the end
+		std::vector<uint32_t> pointFaceVertices;
+	};
+
+	struct CachedResult
+	{
+		std::shared_ptr<const Adjacency> adjacency;
+		pxr::VtVec3fArray points; //!< copies share the buffer of the source, the comparison is cheap when identical
+		pxr::VtVec2fArray st;
+		Result result;
+	};
+
+	std::shared_ptr<const Adjacency> GetAdjacency(const MeshPacker::MeshSource& _source)
+	{
+		const pxr::VtIntArray& counts = _source.faceVertexCounts;
+		const pxr::VtIntArray& indices = _source.faceVertexIndices;
+		size_t hash = MeshPacker::HashTopology(counts, indices, _source.leftHanded);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto range = m_adjacencies.equal_range(hash);
+			for (auto entry = range.first; entry != range.second; ++entry)
+			{
+				const Adjacency& candidate = *entry->second;
+				if (candidate.pointCount == _source.points.size() && candidate.leftHanded == _source.leftHanded
+					&& candidate.counts == counts && candidate.indices == indices)
+				{
+					return entry->second;
+				}
+			}
+		}
+
+		auto adjacency = std::make_shared<Adjacency>();
+		adjacency->counts = counts;
+		adjacency->indices = indices;
+		adjacency->leftHanded = _source.leftHanded;
+		adjacency->pointCount = _source.points.size();
+
+		const size_t faceCount = counts.size();
+		adjacency->firstFaceVertex.resize(faceCount + 1, 0);
+		adjacency->faceOfFaceVertex.resize(indices.size());
+		for (size_t face = 0; face < faceCount; ++face)
+		{
+			if (counts[face] < 0)
+			{
+				return nullptr;
+			}
+			adjacency->firstFaceVertex[face + 1] = adjacency->firstFaceVertex[face] + counts[face];
+		}
+		if (adjacency->firstFaceVertex[faceCount] != indices.size())
+		{
+			return nullptr;
+		}
+
+		// Counting sort of the face-vertices by point.
+		adjacency->firstPointFaceVertex.assign(adjacency->pointCount + 1, 0);
+		for (int point : indices)
+		{
+			if (point < 0 || size_t(point) >= adjacency->pointCount)
+			{
+				return nullptr;
+			}
+			++adjacency->firstPointFaceVertex[point + 1];
+		}
+		for (size_t point = 0; point < adjacency->pointCount; ++point)
+		{
+			adjacency->firstPointFaceVertex[point + 1] += adjacency->firstPointFaceVertex[point];
+		}
+		adjacency->pointFaceVertices.resize(indices.size());
+		std::vector<uint32_t> fill(adjacency->firstPointFaceVertex.begin(), adjacency->firstPointFaceVertex.end() - 1);
+		for (size_t face = 0; face < faceCount; ++face)
+		{
+			for (uint32_t faceVertex = adjacency->firstFaceVertex[face]; faceVertex < adjacency->firstFaceVertex[face + 1]; ++faceVertex)
+			{
+				adjacency->faceOfFaceVertex[faceVertex] = static_cast<uint32_t>(face);
+				adjacency->pointFaceVertices[fill[indices[faceVertex]]++] = faceVertex;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_adjacencies.emplace(hash, adjacency);
+		return adjacency;
+	}
+
+	static void ComputeDerivatives(const Adjacency& _adjacency, const MeshPacker::MeshSource& _source, Result* _result)
+	{
+		const size_t faceCount = _adjacency.counts.size();
+		const size_t pointCount = _adjacency.pointCount;
+		const int* indices = _adjacency.indices.cdata();
+		const uint32_t* firstFaceVertex = _adjacency.firstFaceVertex.data();
+		const pxr::GfVec3f* points = _source.points.cdata();
+
+		const pxr::TfToken& interpolation = _source.stInterpolation;
+		const bool stPerFaceVertex = interpolation == pxr::UsdGeomTokens->faceVarying;
+		const bool stPerPoint = interpolation == pxr::UsdGeomTokens->vertex || interpolation == pxr::UsdGeomTokens->varying;
+		const bool hasTangents = (stPerFaceVertex && _source.st.size() == _adjacency.indices.size())
+			|| (stPerPoint && _source.st.size() == pointCount);
+		const pxr::GfVec2f* st = _source.st.cdata();
+
+		// Pass 1: per face. Newell's normal is twice the area of the face long, which gives the area weighting.
+		std::vector<pxr::GfVec3f> faceNormals(faceCount);
+		std::vector<pxr::GfVec3f> faceTangents(hasTangents ? faceCount : 0);
+		std::vector<pxr::GfVec3f> faceBitangents(hasTangents ? faceCount : 0);
+		const float orientation = _adjacency.leftHanded ? -1.f : 1.f;
+		pxr::WorkParallelForN(faceCount, [&](size_t _begin, size_t _end)
+		{
+			for (size_t face = _begin; face < _end; ++face)
+			{
+				const uint32_t first = firstFaceVertex[face];
+				const uint32_t count = firstFaceVertex[face + 1] - first;
+				pxr::GfVec3f normal(0.f);
+				for (uint32_t k = 0; k < count; ++k)
+				{
+					const pxr::GfVec3f& a = points[indices[first + k]];
+					const pxr::GfVec3f& b = points[indices[first + (k + 1) % count]];
+					normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+					normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+					normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+				}
+				faceNormals[face] = normal * orientation;
+
+				if (!hasTangents)
+				{
+					continue;
+				}
+				// Sum of the tangent frames of the fan triangles, each weighted by its area in st.
+				pxr::GfVec3f tangent(0.f), bitangent(0.f);
+				for (uint32_t k = 1; k + 1 < count; ++k)
+				{
+					const uint32_t c0 = first, c1 = first + k, c2 = first + k + 1;
+					const pxr::GfVec3f e1 = points[indices[c1]] - points[indices[c0]];
+					const pxr::GfVec3f e2 = points[indices[c2]] - points[indices[c0]];
+					const pxr::GfVec2f& uv0 = st[stPerFaceVertex ? c0 : indices[c0]];
+					const pxr::GfVec2f d1 = st[stPerFaceVertex ? c1 : indices[c1]] - uv0;
+					const pxr::GfVec2f d2 = st[stPerFaceVertex ? c2 : indices[c2]] - uv0;
+					const float sign = (d1[0] * d2[1] - d2[0] * d1[1]) < 0.f ? -1.f : 1.f;
+					tangent += (e1 * d2[1] - e2 * d1[1]) * sign;
+					bitangent += (e2 * d1[0] - e1 * d2[0]) * sign;
+				}
+				faceTangents[face] = tangent;
+				faceBitangents[face] = bitangent;
+			}
+		});
+
+		// Pass 2: per point, gathered from the adjacent faces.
+		_result->normals.resize(pointCount);
+		_result->tangents.resize(hasTangents ? pointCount : 0);
+		pxr::GfVec3f* normals = _result->normals.data();
+		pxr::GfVec4f* tangents = _result->tangents.data();
+		const uint32_t* firstPointFaceVertex = _adjacency.firstPointFaceVertex.data();
+		const uint32_t* pointFaceVertices = _adjacency.pointFaceVertices.data();
+		const uint32_t* faceOfFaceVertex = _adjacency.faceOfFaceVertex.data();
+		pxr::WorkParallelForN(pointCount, [&](size_t _begin, size_t _end)
+		{
+			for (size_t point = _begin; point < _end; ++point)
+			{
+				pxr::GfVec3f normal(0.f), tangent(0.f), bitangent(0.f);
+				for (uint32_t i = firstPointFaceVertex[point]; i < firstPointFaceVertex[point + 1]; ++i)
+				{
+					const uint32_t face = faceOfFaceVertex[pointFaceVertices[i]];
+					normal += faceNormals[face];
+					if (hasTangents)
+					{
+						tangent += faceTangents[face];
+						bitangent += faceBitangents[face];
+					}
+				}
+				normal.Normalize();
+				normals[point] = normal;
+
+				if (hasTangents)
+				{
+					// Gram-Schmidt against the normal, the sign tells whether the bitangent is flipped.
+					tangent = tangent - normal * pxr::GfDot(normal, tangent);
+					tangent.Normalize();
+					const float handedness = pxr::GfDot(pxr::GfCross(normal, tangent), bitangent) < 0.f ? -1.f : 1.f;
+					tangents[point] = pxr::GfVec4f(tangent[0], tangent[1], tangent[2], handedness);
+				}
+			}
+		});
+	}
+
+	mutable std::mutex m_mutex;
+	std::unordered_multimap<size_t, std::shared_ptr<const Adjacency>> m_adjacencies;
+	std::map<pxr::SdfPath, CachedResult> m_results;
+};
+
+/*!
+@brief Computes the normals and tangents of the card of the simple shading tutorial, then plays back a deforming grid.
+*/
+void TestFunction_MeshDerivatives()
+{
+	std::cout << "** TestFunction_MeshDerivatives **" << std::endl;
+
+	MeshDerivatives derivatives;
+	MeshDerivatives::Result result;
+
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::Open("simpleShading.usd");
+	pxr::UsdGeomMesh card(stage->GetPrimAtPath(pxr::SdfPath("/TexModel/card")));
+	MeshPacker::MeshSource source;
+	if (MeshPacker::Read(card, pxr::UsdTimeCode::Default(), _authoringTokens->st, &source)
+		&& derivatives.Compute(card.GetPath(), source, &result) && !result.normals.empty())
+	{
+		std::cout << "/TexModel/card: normal " << result.normals[0];
+		if (!result.tangents.empty())
+		{
+			std::cout << ", tangent " << result.tangents[0];
+		}
+		std::cout << std::endl;
+	}
+
+	// A wave running over a grid, every frame moves the points but keeps the topology.
+	MeshPacker::MeshSource grid = MakeBenchmarkGrid(512, 512);
+	const pxr::SdfPath gridPath("/DeformingGrid");
+	const int frameCount = 24;
+	double seconds = 0.;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		pxr::GfVec3f* points = grid.points.data();
+		for (size_t i = 0; i < grid.points.size(); ++i)
+		{
+			points[i][2] = std::sin(0.05f * points[i][0] + 0.25f * frame);
+		}
+		auto start = std::chrono::steady_clock::now();
+		derivatives.Compute(gridPath, grid, &result);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	std::cout << "Deforming grid: " << grid.points.size() << " points, " << frameCount / seconds << " frames/s" << std::endl;
+
+	derivatives.Compute(gridPath, grid, &result);
+	std::cout << "Same frame again: " << (result.recomputed ? "recomputed" : "taken from the cache")
+		<< ", topologies in the cache: " << derivatives.GetCachedTopologyCount() << std::endl;
+}
+
+/*!
+@brief Opens stages in the background, independent stages in parallel.
+@details Every stage is opened by a task of the work pool in two phases. First the layers of the stage
+		 are loaded: the root layer, then the layers it depends on (sublayers, references,
+		 payloads), breadth first. A layer needed by several stages is parsed only once, the
+		 other stages wait for that parse instead of starting their own. Then the stage is
+		 composed from the loaded layers, which are found in the layer registry.
+		 The progress of every stage is reported through the callback, called by one thread at
+		 a time. A cancelled stage stops before its next layer or before composing, and its
+		 future holds a null stage, as does the future of a stage that failed to open.
+		 The loaded layers are kept until the opener is destroyed, so that the stages opened
+		 later share them too. Open and Wait are called by the thread owning the opener,
+		 Cancel by any thread, also while the owner waits.
+*/
+class AsyncStageOpener
+{
+public:
+	enum class State { Queued, LoadingLayers, Composing, Done, Failed, Cancelled };
+
+	using ProgressCallback = std::function<void(const std::string& _path, State _state, size_t _loadedLayers)>;
+
+	explicit AsyncStageOpener(ProgressCallback _progress = ProgressCallback())
+		: m_progress(std::move(_progress))
+	{
+	}
+
+	~AsyncStageOpener()
+	{
+		Wait();
+	}
+
+	AsyncStageOpener(const AsyncStageOpener&) = delete;
+	AsyncStageOpener& operator=(const AsyncStageOpener&) = delete;
+
+	std::shared_future<pxr::UsdStageRefPtr> Open(const std::string& _path)
+	{
+		std::lock_guard<std::mutex> lock(m_jobsMutex);
+		m_jobs.push_back(std::make_unique<Job>());
+		Job& job = *m_jobs.back();
+		job.path = _path;
+		job.future = job.promise.get_future().share();
+		Report(job, State::Queued);
+		m_dispatcher.Run([this, &job]() { Run(job); });
+		return job.future;
+	}
+
+	//! Cancels all the pending opens of the stage at _path.
+	void Cancel(const std::string& _path)
+	{
+		std::lock_guard<std::mutex> lock(m_jobsMutex);
+		for (const std::unique_ptr<Job>& job : m_jobs)
+		{
+			if (job->path == _path)
+			{
+				job->cancelled = true;
+			}
+		}
+	}
+
+	void Wait()
+	{
+		m_dispatcher.Wait();
+	}
+
+	static const char* ToString(State _state)
+	{
+		switch (_state)
+		{
+		case State::Queued: return "queued";
+		case State::LoadingLayers: return "loading layers";
+		case State::Composing: return "composing";
+		case State::Done: return "done";
+		case State::Failed: return "FAILED";
+		default: return "cancelled";
+		}
+	}
+
+private:
+	struct Job
+	{
+		std::string path;
+		std::atomic<bool> cancelled{ false };
+		size_t loadedLayers = 0;
+		std::promise<pxr::UsdStageRefPtr> promise;
+		std::shared_future<pxr::UsdStageRefPtr> future;
+	};
+
+	void Report(const Job& _job, State _state)
+	{
+		if (m_progress)
+		{
+			std::lock_guard<std::mutex> lock(m_progressMutex);
+			m_progress(_job.path, _state, _job.loadedLayers);
+		}
+	}
+
+	/*!
+	@brief Returns the layer, parsing it unless another thread parses or has parsed it already.
+	@details The jobs run as tasks of the work pool, and a task needing a layer parsed by another
+			 task blocks on it. Parsing and composing may wait for work internally, and a waiting
+			 thread runs other tasks meanwhile: if it ran a job needing the layer it is parsing, that
+			 job would wait for its own thread. So both run with scoped parallelism, which only lets
+			 the thread run the work they started, and parsing never waits for another layer.
+	*/
+	pxr::SdfLayerRefPtr LoadLayer(const std::string& _identifier)
+	{
+		std::promise<pxr::SdfLayerRefPtr> promise;
+		std::shared_future<pxr::SdfLayerRefPtr> future;
+		bool parseHere = false;
+		{
+			std::lock_guard<std::mutex> lock(m_layersMutex);
+			auto loading = m_layers.find(_identifier);
+			if (loading != m_layers.end())
+			{
+				future = loading->second;
+			}
+			else
+			{
+				future = promise.get_future().share();
+				m_layers.emplace(_identifier, future);
+				parseHere = true;
+			}
+		}
+		if (parseHere)
+		{
+			pxr::SdfLayerRefPtr layer;
+			pxr::WorkWithScopedParallelism([&]() { layer = pxr::SdfLayer::FindOrOpen(_identifier); });
+			promise.set_value(layer);
+		}
+		return future.get();
+	}
+
+	void Run(Job& _job)
+	{
+		Report(_job, State::LoadingLayers);
+
+		std::string rootIdentifier = std::filesystem::absolute(_job.path).lexically_normal().string();
+		std::deque<std::string> toLoad{ rootIdentifier };
+		std::set<std::string> seen{ rootIdentifier };
+		pxr::SdfLayerRefPtr rootLayer;
+		while (!toLoad.empty())
+		{
+			if (_job.cancelled)
+			{
+				Report(_job, State::Cancelled);
+				_job.promise.set_value(pxr::UsdStageRefPtr());
+				return;
+			}
+			std::string identifier = toLoad.front();
+			toLoad.pop_front();
+			pxr::SdfLayerRefPtr layer = LoadLayer(identifier);
+			if (!layer)
+			{
+				continue; // composition reports the missing layers
+			}
+			if (!rootLayer)
+			{
+				rootLayer = layer;
+			}
+			++_job.loadedLayers;
+			Report(_job, State::LoadingLayers);
+
+			for (const std::string& dependency : layer->GetCompositionAssetDependencies())
+			{
+				std::string anchored = pxr::SdfComputeAssetPathRelativeToLayer(layer, dependency);
+				if (seen.insert(anchored).second)
+				{
+					toLoad.push_back(anchored);
+				}
+			}
+		}
+
+		if (_job.cancelled || !rootLayer)
+		{
+			Report(_job, rootLayer ? State::Cancelled : State::Failed);
+			_job.promise.set_value(pxr::UsdStageRefPtr());
+			return;
+		}
+
+		Report(_job, State::Composing);
+		pxr::UsdStageRefPtr stage;
+		pxr::WorkWithScopedParallelism([&]() { stage = pxr::UsdStage::Open(rootLayer); }); // see LoadLayer
+		Report(_job, stage ? State::Done : State::Failed);
+		_job.promise.set_value(stage);
+	}
+
+	ProgressCallback m_progress;
+	std::mutex m_progressMutex;
+	std::mutex m_jobsMutex;
+	std::vector<std::unique_ptr<Job>> m_jobs;
+	std::mutex m_layersMutex;
+	std::map<std::string, std::shared_future<pxr::SdfLayerRefPtr>> m_layers;
+	pxr::WorkDispatcher m_dispatcher;
+};
+
+/*!
+@brief Opens all the stages written by the tutorials at once, and compares with opening them one after the other.
+*/
+void TestFunction_AsyncStageOpen()
+{
+	std::cout << "** TestFunction_AsyncStageOpen **" << std::endl;
+
+	const std::vector<std::string> paths = { "HelloWorld.usda", "HelloWorldWithVariants.usda", "RefExample.usda",
+		"Step1.usda", "Step2.usda", "Step3.usda", "Step4.usda", "Step4A.usda", "Step5.usda", "Step6.usda", "simpleShading.usd" };
+
+	auto start = std::chrono::steady_clock::now();
+	for (const std::string& path : paths)
+	{
+		pxr::UsdStageRefPtr stage = pxr::UsdStage::Open(path);
+	}
+	double serialSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	std::vector<std::shared_future<pxr::UsdStageRefPtr>> stages;
+	{
+		AsyncStageOpener opener([](const std::string& _path, AsyncStageOpener::State _state, size_t _loadedLayers)
+		{
+			if (_state != AsyncStageOpener::State::LoadingLayers)
+			{
+				std::cout << _path << ": " << AsyncStageOpener::ToString(_state) << " (" << _loadedLayers << " layers loaded)" << std::endl;
+			}
+		});
+		for (const std::string& path : paths)
+		{
+			stages.push_back(opener.Open(path));
+		}
+		opener.Cancel("Step1.usda"); // may already be done, Step1.usda has no dependency
+
+		size_t opened = 0;
+		for (const std::shared_future<pxr::UsdStageRefPtr>& stage : stages)
+		{
+			opened += stage.get() ? 1 : 0;
+		}
+		double asyncSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << opened << " of " << paths.size() << " stages opened in " << asyncSeconds
+			<< " s, one after the other they took " << serialSeconds << " s" << std::endl;
+	}
+}
+
+/*!
+@brief Measures what composing the prims of a stage costs, per prim index.
+@details For every prim, Measure() records the composition arcs of its index (references,
+		 payloads, variants, ...), the depth of the deepest layer stack it draws from, and the time
+		 to compute the index again, the best of a few runs. The prim indexes recomposed by
+		 the edits of the stage are counted from the resync notices. There is no public hook
+		 inside Pcp, so the time is per prim index, the arcs of a prim are not timed one by one.
+		 The report ranks the prims by time, the folded stacks, one line per prim with its
+		 ancestors as frames and its time in microseconds, are read by flamegraph.pl and speedscope.
+*/
+class CompositionProfiler : public pxr::TfWeakBase
+{
+public:
+	struct PrimCost
+	{
+		pxr::SdfPath path;
+		std::vector<std::string> arcs; //!< "<arc type> <layer>" for every arc of the prim index
+		size_t layerStackDepth = 0;
+		double seconds = 0.0;
+		size_t recompositions = 0;
+	};
+
+	explicit CompositionProfiler(const pxr::UsdStageRefPtr& _stage)
+		: m_stage(_stage)
+	{
+		m_noticeKey = pxr::TfNotice::Register(pxr::TfCreateWeakPtr(this), &CompositionProfiler::OnObjectsChanged,
+			pxr::UsdStageWeakPtr(m_stage));
+	}
+
+	~CompositionProfiler()
+	{
+		pxr::TfNotice::Revoke(m_noticeKey);
+	}
+
+	CompositionProfiler(const CompositionProfiler&) = delete;
+	CompositionProfiler& operator=(const CompositionProfiler&) = delete;
+
+	//! Measures all the prims of the stage, keeping the recomposition counts of the prims measured before.
+	void Measure(int _runs = 3)
+	{
+		std::map<pxr::SdfPath, PrimCost> costs;
+		for (pxr::UsdPrim prim : m_stage->TraverseAll())
+		{
+			PrimCost& cost = costs[prim.GetPath()];
+			cost.path = prim.GetPath();
+			auto previous = m_costs.find(cost.path);
+			cost.recompositions = previous == m_costs.end() ? 0 : previous->second.recompositions;
+
+			cost.seconds = -1.0;
+			pxr::PcpPrimIndex index;
+			for (int run = 0; run < _runs; ++run)
+			{
+				auto start = std::chrono::steady_clock::now();
+				index = prim.ComputeExpandedPrimIndex();
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				cost.seconds = cost.seconds < 0.0 ? seconds : std::min(cost.seconds, seconds);
+			}
+
+			pxr::PcpNodeRange nodes = index.GetNodeRange();
+			for (auto node = nodes.first; node != nodes.second; ++node)
+			{
+				const pxr::PcpLayerStackRefPtr& layerStack = (*node).GetLayerStack();
+				if (layerStack)
+				{
+					cost.layerStackDepth = std::max(cost.layerStackDepth, layerStack->GetLayers().size());
+				}
+				if ((*node).GetArcType() != pxr::PcpArcTypeRoot)
+				{
+					pxr::SdfLayerHandle layer = layerStack ? layerStack->GetIdentifier().rootLayer : pxr::SdfLayerHandle();
+					cost.arcs.push_back(pxr::TfEnum::GetDisplayName((*node).GetArcType()) + " "
+						+ (layer ? layer->GetDisplayName() : std::string("?")));
+				}
+			}
+		}
+		m_costs.swap(costs);
+	}
+
+	//! The measured prims, the most expensive first.
+	std::vector<PrimCost> GetRanked() const
+	{
+		std::vector<PrimCost> ranked;
+		for (const auto& pathAndCost : m_costs)
+		{
+			ranked.push_back(pathAndCost.second);
+		}
+		std::stable_sort(ranked.begin(), ranked.end(),
+			[](const PrimCost& _a, const PrimCost& _b) { return _a.seconds > _b.seconds; });
+		return ranked;
+	}
+
+	void PrintReport(std::ostream& _out, size_t _count = 10) const
+	{
+		std::vector<PrimCost> ranked = GetRanked();
+		_out << "Composition of " << m_stage->GetRootLayer()->GetDisplayName() << ", " << ranked.size() << " prims:" << std::endl;
+		for (size_t rank = 0; rank < ranked.size() && rank < _count; ++rank)
+		{
+			const PrimCost& cost = ranked[rank];
+			_out << "#" << rank + 1 << " " << cost.path << ": " << cost.seconds * 1e6 << " us, " << cost.arcs.size()
+				<< " arcs, layer stack depth " << cost.layerStackDepth << ", recomposed " << cost.recompositions << " times" << std::endl;
+			for (const std::string& arc : cost.arcs)
+			{
+				_out << "    " << arc << std::endl;
+			}
+		}
+	}
+
+	bool WriteFoldedStacks(const std::string& _path) const
+	{
+		std::ofstream out(_path);
+		const std::string stageFrame = m_stage->GetRootLayer()->GetDisplayName();
+		for (const auto& pathAndCost : m_costs)
+		{
+			out << stageFrame;
+			for (const pxr::SdfPath& prefix : pathAndCost.first.GetPrefixes())
+			{
+				out << ';' << prefix.GetName();
+			}
+			out << ' ' << std::llround(pathAndCost.second.seconds * 1e6) << '\n';
+		}
+		return bool(out);
+	}
+
+private:
+	void OnObjectsChanged(const pxr::UsdNotice::ObjectsChanged& _notice, const pxr::UsdStageWeakPtr&)
+	{
+		for (const pxr::SdfPath& path : _notice.GetResyncedPaths())
+		{
+			if (!path.IsPrimPath() && !path.IsAbsoluteRootPath())
+			{
+				continue; // a property added or removed, the prim index is kept
+			}
+			for (auto cost = m_costs.lower_bound(path); cost != m_costs.end() && cost->first.HasPrefix(path); ++cost)
+			{
+				++cost->second.recompositions;
+			}
+		}
+	}
+
+	pxr::UsdStageRefPtr m_stage;
+	pxr::TfNotice::Key m_noticeKey;
+	std::map<pxr::SdfPath, PrimCost> m_costs;
+};
+
+/*!
+@brief Profiles the composition of the stages of the tutorials with the most arcs.
+*/
+void TestFunction_CompositionProfile()
+{
+	std::cout << "** TestFunction_CompositionProfile **" << std::endl;
+
+	pxr::UsdStageRefPtr assembly = pxr::UsdStage::Open("Step6.usda");
+	CompositionProfiler assemblyProfiler(assembly);
+	assemblyProfiler.Measure();
+	assemblyProfiler.PrintReport(std::cout);
+	if (assemblyProfiler.WriteFoldedStacks("Step6.usda.folded"))
+	{
+		std::cout << "Folded stacks written to Step6.usda.folded" << std::endl;
+	}
+
+	// Every switch of the variant recomposes /hello and the prims below it.
+	pxr::UsdStageRefPtr variants = pxr::UsdStage::Open("HelloWorldWithVariants.usda");
+	CompositionProfiler variantsProfiler(variants);
+	variantsProfiler.Measure();
+	pxr::UsdVariantSet shadingVariant = variants->GetPrimAtPath(pxr::SdfPath("/hello")).GetVariantSet("shadingVariant");
+	for (const char* variant : { "red", "blue", "green" })
+	{
+		shadingVariant.SetVariantSelection(variant);
+	}
+	variantsProfiler.Measure();
+	variantsProfiler.PrintReport(std::cout);
+}
+
+/*!
+@brief Compares two stages, or two layers, prim by prim.
+@details Both sides are read into trees of prims matched by path. Each prim holds its specs:
+		 the prim itself and its properties, with their fields (metadata, default values, time
+		 samples, targets). For a stage these are the composed and authored opinions, for a layer
+		 the specs as written, the variants being children of their prim. The specs are read and
+		 hashed in parallel, then the hash of every subtree is combined from its children, so
+		 the comparison skips the subtrees whose hashes are the same, and the differing subtrees
+		 are compared in parallel. The order of the children of a prim is not compared.
+		 Write() prints the changes one per line: "+ <path>", "- <path>" or "~ <path> <field>".
+		 Compare() returns false when either side is null, e.g. a stage that failed to open,
+		 so that a failure is not mistaken for two identical sides.
+*/
+class SceneDiff
+{
+public:
+	enum class ChangeType { Added, Removed, Changed };
+
+	struct Change
+	{
+		ChangeType type;
+		pxr::SdfPath path;  //!< of a prim or a property
+		pxr::TfToken field; //!< empty when the whole spec is added or removed
+
+		bool operator<(const Change& _other) const
+		{
+			return path != _other.path ? path < _other.path : field < _other.field;
+		}
+	};
+
+	struct Statistics
+	{
+		size_t primsA = 0;
+		size_t primsB = 0;
+		size_t subtreesSkipped = 0;
+		double seconds = 0.0;
+	};
+
+	/*!
+	@return false if either stage is null, _changes is then left empty.
+	@param _changes receives the changes from _a to _b, sorted by path
+	*/
+	static bool Compare(const pxr::UsdStageRefPtr& _a, const pxr::UsdStageRefPtr& _b, std::vector<Change>* _changes, Statistics* _statistics = nullptr)
+	{
+		_changes->clear();
+		if (!_a || !_b)
+		{
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Tree a = ReadStage(_a);
+		Tree b = ReadStage(_b);
+		*_changes = Compare(a, b, start, _statistics);
+		return true;
+	}
+
+	//! The same for two layers, false if either layer is null.
+	static bool Compare(const pxr::SdfLayerHandle& _a, const pxr::SdfLayerHandle& _b, std::vector<Change>* _changes, Statistics* _statistics = nullptr)
+	{
+		_changes->clear();
+		if (!_a || !_b)
+		{
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Tree a = ReadLayer(_a);
+		Tree b = ReadLayer(_b);
+		*_changes = Compare(a, b, start, _statistics);
+		return true;
+	}
+
+	static void Write(std::ostream& _out, const std::vector<Change>& _changes)
+	{
+		for (const Change& change : _changes)
+		{
+			switch (change.type)
+			{
+			case ChangeType::Added: _out << "+ " << change.path << '\n'; break;
+			case ChangeType::Removed: _out << "- " << change.path << '\n'; break;
+			default: _out << "~ " << change.path << ' ' << change.field << '\n'; break;
+			}
+		}
+	}
+
+private:
+	using Fields = std::map<pxr::TfToken, pxr::VtValue>;
+
+	struct Node
+	{
+		pxr::SdfPath path;
+		std::map<pxr::SdfPath, Fields> specs;
+		std::vector<std::pair<std::string, size_t>> children; //!< by name, sorted
+		uint64_t hash = 0;
+		uint64_t subtreeHash = 0;
+	};
+
+	using Tree = std::vector<Node>; //!< the root first, every parent before its children
+
+	static uint64_t Combine(uint64_t _seed, uint64_t _value)
+	{
+		return _seed ^ (_value + 0x9e3779b97f4a7c15ull + (_seed << 6) + (_seed >> 2));
+	}
+
+	static uint64_t HashValue(const pxr::VtValue& _value)
+	{
+		if (!_value.IsHolding<pxr::SdfTimeSampleMap>())
+		{
+			return _value.GetHash();
+		}
+		uint64_t hash = 0;
+		for (const auto& timeAndValue : _value.UncheckedGet<pxr::SdfTimeSampleMap>())
+		{
+			hash = Combine(Combine(hash, std::hash<double>()(timeAndValue.first)), timeAndValue.second.GetHash());
+		}
+		return hash;
+	}
+
+	static void HashSpecs(Node* _node)
+	{
+		uint64_t hash = 0;
+		for (const auto& pathAndFields : _node->specs)
+		{
+			hash = Combine(hash, pxr::SdfPath::Hash()(pathAndFields.first));
+			for (const auto& field : pathAndFields.second)
+			{
+				hash = Combine(Combine(hash, field.first.Hash()), HashValue(field.second));
+			}
+		}
+		_node->hash = hash;
+	}
+
+	//! Links the nodes to their parents and combines the hashes of the subtrees, children first.
+	static void LinkAndHashSubtrees(Tree* _tree, const std::vector<size_t>& _parents)
+	{
+		for (size_t node = 1; node < _tree->size(); ++node)
+		{
+			Node& child = (*_tree)[node];
+			(*_tree)[_parents[node]].children.emplace_back(child.path.GetElementString(), node);
+		}
+		for (size_t node = _tree->size(); node-- > 0;)
+		{
+			Node& parent = (*_tree)[node];
+			std::sort(parent.children.begin(), parent.children.end());
+			parent.subtreeHash = parent.hash;
+			for (const auto& nameAndChild : parent.children)
+			{
+				parent.subtreeHash = Combine(parent.subtreeHash, (*_tree)[nameAndChild.second].subtreeHash);
+			}
+		}
+	}
+
+	static Tree ReadStage(const pxr::UsdStageRefPtr& _stage)
+	{
+		std::vector<pxr::UsdPrim> prims;
+		std::vector<size_t> parents;
+		std::map<pxr::SdfPath, size_t> indices;
+		for (pxr::UsdPrim prim : pxr::UsdPrimRange(_stage->GetPseudoRoot(), pxr::UsdPrimAllPrimsPredicate))
+		{
+			auto parent = indices.find(prim.GetPath().GetParentPath());
+			parents.push_back(parent == indices.end() ? 0 : parent->second);
+			indices.emplace(prim.GetPath(), prims.size());
+			prims.push_back(prim);
+		}
+
+		Tree tree(prims.size());
+		pxr::WorkParallelForN(prims.size(), [&](size_t _begin, size_t _end)
+		{
+			for (size_t i = _begin; i < _end; ++i)
+			{
+				const pxr::UsdPrim& prim = prims[i];
+				Node& node = tree[i];
+				node.path = prim.GetPath();
+
+				Fields& primFields = node.specs[node.path];
+				for (const auto& metadata : prim.GetAllAuthoredMetadata())
+				{
+					primFields[metadata.first] = metadata.second;
+				}
+				primFields[pxr::SdfFieldKeys->TypeName] = pxr::VtValue(prim.GetTypeName());
+				primFields[pxr::SdfFieldKeys->Active] = pxr::VtValue(prim.IsActive());
+
+				for (const pxr::UsdProperty& property : prim.GetAuthoredProperties())
+				{
+					Fields& fields = node.specs[property.GetPath()];
+					for (const auto& metadata : property.GetAllAuthoredMetadata())
+					{
+						fields[metadata.first] = metadata.second;
+					}
+					if (pxr::UsdAttribute attribute = property.As<pxr::UsdAttribute>())
+					{
+						pxr::VtValue value;
+						if (attribute.Get(&value, pxr::UsdTimeCode::Default()))
+						{
+							fields[pxr::SdfFieldKeys->Default] = value;
+						}
+						std::vector<double> times;
+						if (attribute.GetTimeSamples(&times) && !times.empty())
+						{
+							pxr::SdfTimeSampleMap samples;
+							for (double time : times)
+							{
+								attribute.Get(&samples[time], time);
+							}
+							fields[pxr::SdfFieldKeys->TimeSamples] = pxr::VtValue(samples);
+						}
+					}
+					else if (pxr::UsdRelationship relationship = property.As<pxr::UsdRelationship>())
+					{
+						pxr::SdfPathVector targets;
+						relationship.GetTargets(&targets);
+						fields[pxr::SdfFieldKeys->TargetPaths] = pxr::VtValue(targets);
+					}
+				}
+				HashSpecs(&node);
+			}
+		});
+		LinkAndHashSubtrees(&tree, parents);
+		return tree;
+	}
+
+	static Tree ReadLayer(const pxr::SdfLayerHandle& _layer)
+	{
+		// the prims, then the prims of their variants
+		std::vector<pxr::SdfPrimSpecHandle> prims{ _layer->GetPseudoRoot() };
+		std::vector<size_t> parents{ 0 };
+		for (size_t i = 0; i < prims.size(); ++i)
+		{
+			pxr::SdfPrimSpecHandle prim = prims[i];
+			for (const pxr::SdfPrimSpecHandle& child : prim->GetNameChildren())
+			{
+				prims.push_back(child);
+				parents.push_back(i);
+			}
+			for (const auto& nameAndVariantSet : prim->GetVariantSets())
+			{
+				for (const pxr::SdfVariantSpecHandle& variant : nameAndVariantSet.second->GetVariantList())
+				{
+					prims.push_back(variant->GetPrimSpec());
+					parents.push_back(i);
+				}
+			}
+		}
+
+		static const std::set<pxr::TfToken> children = { pxr::SdfChildrenKeys->PrimChildren,
+			pxr::SdfChildrenKeys->PropertyChildren, pxr::SdfChildrenKeys->VariantSetChildren };
+
+		Tree tree(prims.size());
+		pxr::WorkParallelForN(prims.size(), [&](size_t _begin, size_t _end)
+		{
+			for (size_t i = _begin; i < _end; ++i)
+			{
+				const pxr::SdfPrimSpecHandle& prim = prims[i];
+				Node& node = tree[i];
+				node.path = prim->GetPath();
+
+				Fields& primFields = node.specs[node.path];
+				for (const pxr::TfToken& field : prim->ListFields())
+				{
+					if (!children.count(field))
+					{
+						primFields[field] = prim->GetField(field);
+					}
+				}
+				for (const pxr::SdfPropertySpecHandle& property : prim->GetProperties())
+				{
+					Fields& fields = node.specs[property->GetPath()];
+					for (const pxr::TfToken& field : property->ListFields())
+					{
+						fields[field] = property->GetField(field);
+					}
+				}
+				HashSpecs(&node);
+			}
+		});
+		LinkAndHashSubtrees(&tree, parents);
+		return tree;
+	}
+
+	struct Comparison
+	{
+		const Tree& treeA;
+		const Tree& treeB;
+		pxr::WorkDispatcher dispatcher;
+		std::mutex mutex;
+		std::vector<Change> changes;
+		std::atomic<size_t> subtreesSkipped{ 0 };
+
+		void CompareNodes(size_t _a, size_t _b)
+		{
+			const Node& a = treeA[_a];
+			const Node& b = treeB[_b];
+			std::vector<Change> found;
+			if (a.hash != b.hash)
+			{
+				CompareSpecs(a.specs, b.specs, &found);
+			}
+
+			auto childA = a.children.begin();
+			auto childB = b.children.begin();
+			while (childA != a.children.end() || childB != b.children.end())
+			{
+				if (childB == b.children.end() || (childA != a.children.end() && childA->first < childB->first))
+				{
+					found.push_back({ ChangeType::Removed, treeA[childA->second].path, pxr::TfToken() });
+					++childA;
+				}
+				else if (childA == a.children.end() || childB->first < childA->first)
+				{
+					found.push_back({ ChangeType::Added, treeB[childB->second].path, pxr::TfToken() });
+					++childB;
+				}
+				else
+				{
+					if (treeA[childA->second].subtreeHash == treeB[childB->second].subtreeHash)
+					{
+						++subtreesSkipped;
+					}
+					else
+					{
+						size_t nextA = childA->second;
+						size_t nextB = childB->second;
+						dispatcher.Run([this, nextA, nextB]() { CompareNodes(nextA, nextB); });
+					}
+					++childA;
+					++childB;
+				}
+			}
+
+			if (!found.empty())
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				changes.insert(changes.end(), found.begin(), found.end());
+			}
+		}
+
+		static void CompareSpecs(const std::map<pxr::SdfPath, Fields>& _a, const std::map<pxr::SdfPath, Fields>& _b, std::vector<Change>* _changes)
+		{
+			auto specA = _a.begin();
+			auto specB = _b.begin();
+			while (specA != _a.end() || specB != _b.end())
+			{
+				if (specB == _b.end() || (specA != _a.end() && specA->first < specB->first))
+				{
+					_changes->push_back({ ChangeType::Removed, specA->first, pxr::TfToken() });
+					++specA;
+				}
+				else if (specA == _a.end() || specB->first < specA->first)
+				{
+					_changes->push_back({ ChangeType::Added, specB->first, pxr::TfToken() });
+					++specB;
+				}
+				else
+				{
+					std::set<pxr::TfToken> fields;
+					for (const auto& field : specA->second)
+					{
+						fields.insert(field.first);
+					}
+					for (const auto& field : specB->second)
+					{
+						fields.insert(field.first);
+					}
+					for (const pxr::TfToken& field : fields)
+					{
+						auto valueA = specA->second.find(field);
+						auto valueB = specB->second.find(field);
+						if (valueA == specA->second.end() || valueB == specB->second.end() || valueA->second != valueB->second)
+						{
+							_changes->push_back({ ChangeType::Changed, specA->first, field });
+						}
+					}
+					++specA;
+					++specB;
+				}
+			}
+		}
+	};
+
+	static std::vector<Change> Compare(const Tree& _a, const Tree& _b, std::chrono::steady_clock::time_point _start, Statistics* _statistics)
+	{
+		Comparison comparison{ _a, _b };
+		if (_a[0].subtreeHash != _b[0].subtreeHash)
+		{
+			comparison.dispatcher.Run([&comparison]() { comparison.CompareNodes(0, 0); });
+			comparison.dispatcher.Wait();
+		}
+		std::sort(comparison.changes.begin(), comparison.changes.end());
+
+		if (_statistics)
+		{
+			_statistics->primsA = _a.size();
+			_statistics->primsB = _b.size();
+			_statistics->subtreesSkipped = comparison.subtreesSkipped;
+			_statistics->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		}
+		return std::move(comparison.changes);
+	}
+};
+
+/*!
+@brief Compares the outputs of the tutorials which differ by one step.
+*/
+void TestFunction_SceneDiff()
+{
+	std::cout << "** TestFunction_SceneDiff **" << std::endl;
+
+	SceneDiff::Statistics statistics;
+	std::vector<SceneDiff::Change> changes;
+	if (SceneDiff::Compare(pxr::SdfLayer::FindOrOpen("HelloWorld.usda"), pxr::SdfLayer::FindOrOpen("HelloWorldWithVariants.usda"), &changes))
+	{
+		std::cout << "Layers HelloWorld.usda and HelloWorldWithVariants.usda, " << changes.size() << " changes:" << std::endl;
+		SceneDiff::Write(std::cout, changes);
+	}
+	else
+	{
+		std::cout << "Layers HelloWorld.usda and HelloWorldWithVariants.usda: FAILED to open" << std::endl;
+	}
+
+	if (!SceneDiff::Compare(pxr::UsdStage::Open("Step4.usda"), pxr::UsdStage::Open("Step4A.usda"), &changes, &statistics))
+	{
+		std::cout << "Stages Step4.usda and Step4A.usda: FAILED to open" << std::endl;
+		return;
+	}
+	std::cout << "Stages Step4.usda and Step4A.usda, " << changes.size() << " changes:" << std::endl;
+	SceneDiff::Write(std::cout, changes);
+	std::cout << statistics.primsA << " and " << statistics.primsB << " prims compared in " << statistics.seconds
+		<< " s, " << statistics.subtreesSkipped << " identical subtrees skipped" << std::endl;
+}
+
+/*!
+@brief Records time samples at a high rate into an append-only log, readable as a layer.
+@details Samples are appended to a chunk in memory, which is compressed and written to the
+		 end of the file when it is full, with a single write, so that a reader opening the
+		 log while it is recorded sees whole chunks only. A channel, the attribute the samples
+		 of which are recorded, is declared in the log before its first sample.
+		 A chunk is a header (kind, raw size, stored size) followed by its data:
+		 - a channel: the value type and the path of the attribute,
+		 - samples: records of channel index, time and value, compressed with TfFastCompression.
+		 Read() turns the log, or the part of it after an offset, into a layer of over specs,
+		 which can be sublayered over the recorded scene. ExportSegment() writes the samples
+		 since the previous segment as a crate layer.
+		 Once a write fails, e.g. the disk is full, Append() and Flush() return false.
+		 Note: the log is not an SdfFileFormat, a file format plugin needs a plugInfo.json found
+		 by the plugin registry, which this executable does not install.
+*/
+class TimeSampleCaptureLog
+{
+public:
+	enum class ValueType : uint8_t { Float, Double, Vec3f, Vec3d };
+
+	explicit TimeSampleCaptureLog(const std::string& _path, size_t _chunkSize = size_t(1) << 20)
+		: m_path(_path)
+		, m_chunkSize(std::min(_chunkSize, size_t(pxr::TfFastCompression::GetMaxInputSize())))
+		, m_out(_path, std::ios::binary | std::ios::trunc)
+	{
+		m_out.write(s_magic, sizeof(s_magic));
+		m_out.flush();
+		m_offset = sizeof(s_magic);
+		m_samples.reserve(m_chunkSize + RecordSize(ValueType::Vec3d));
+	}
+
+	~TimeSampleCaptureLog()
+	{
+		Flush();
+	}
+
+	//! Declares the attribute at _path, returns the channel to give to Append().
+	uint32_t AddChannel(const pxr::SdfPath& _path, ValueType _type)
+	{
+		std::string data(1, char(_type));
+		data += _path.GetString();
+		WriteChunk(ChunkKind::Channel, data.data(), data.size(), data.size());
+		m_channels.push_back(_type);
+		return uint32_t(m_channels.size() - 1);
+	}
+
+	//! Returns false if the channel does not record values of type T, or if the log could not be written.
+	template<class T>
+	bool Append(uint32_t _channel, double _time, const T& _value)
+	{
+		if (!m_out || _channel >= m_channels.size() || m_channels[_channel] != TypeOf(_value))
+		{
+			return false;
+		}
+		size_t offset = m_samples.size();
+		m_samples.resize(offset + sizeof(uint32_t) + sizeof(double) + sizeof(T));
+		char* record = m_samples.data() + offset;
+		std::memcpy(record, &_channel, sizeof(uint32_t));
+		std::memcpy(record + sizeof(uint32_t), &_time, sizeof(double));
+		std::memcpy(record + sizeof(uint32_t) + sizeof(double), &_value, sizeof(T));
+		if (m_samples.size() >= m_chunkSize && !Flush())
+		{
+			return false;
+		}
+		++m_sampleCount;
+		return true;
+	}
+
+	//! Writes the samples appended since the last chunk, returns false if the log could not be written.
+	bool Flush()
+	{
+		if (m_samples.empty())
+		{
+			return bool(m_out);
+		}
+		m_compressed.resize(pxr::TfFastCompression::GetCompressedBufferSize(m_samples.size()));
+		size_t compressedSize = pxr::TfFastCompression::CompressToBuffer(m_samples.data(), m_compressed.data(), m_samples.size());
+		bool written = WriteChunk(ChunkKind::Samples, m_compressed.data(), m_samples.size(), compressedSize);
+		m_samples.clear();
+		return written;
+	}
+
+	/*!
+	@brief Writes the samples recorded since the previous segment as a layer, e.g. a crate file.
+	@return false if the layer could not be written, the samples are then in the next segment.
+	*/
+	bool ExportSegment(const std::string& _layerPath)
+	{
+		if (!Flush())
+		{
+			return false;
+		}
+		uint64_t end = 0;
+		pxr::SdfLayerRefPtr segment = Read(m_path, m_segmentOffset, &end);
+		if (!segment || !segment->Export(_layerPath))
+		{
+			return false;
+		}
+		m_segmentOffset = end;
+		return true;
+	}
 
-	// -- Step 6
-	std::cout << "---- Step 6 ----" << std::endl;
+	size_t GetSampleCount() const
+	{
+		return m_sampleCount;
+	}
 
-	/*! Python code from the tutorial
-		# Use animated layer from Step5
-		anim_layer_path = './Step5.usda'
+	/*!
+	@brief Reads the log into an anonymous layer, with the samples of the chunks starting at or after _fromOffset.
+	@details A chunk still being written at the end of the log is ignored, reading stops at a corrupt chunk.
+	@param _endOffset receives the offset after the last whole chunk
+	@param _sampleCount receives the number of samples read
+	*/
+	static pxr::SdfLayerRefPtr Read(const std::string& _path, uint64_t _fromOffset = 0, uint64_t* _endOffset = nullptr, size_t* _sampleCount = nullptr)
+	{
+		std::ifstream in(_path, std::ios::binary);
+		char magic[sizeof(s_magic)];
+		if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, s_magic, sizeof(magic)) != 0)
+		{
+			return pxr::SdfLayerRefPtr();
+		}
 
-		stage = MakeInitialStage('Step6.usda')
-		stage.SetMetadata('comment', 'Step 6: Layer offsets and animation')
+		struct Channel
+		{
+			pxr::SdfPath path;
+			ValueType type;
+			pxr::SdfTimeSampleMap samples;
+		};
+		std::vector<Channel> channels;
+		std::vector<char> stored;
+		std::vector<char> raw;
+		size_t sampleCount = 0;
+		uint64_t offset = sizeof(s_magic);
+		for (;;)
+		{
+			char header[s_headerSize];
+			if (!in.read(header, sizeof(header)))
+			{
+				break;
+			}
+			uint32_t rawSize = 0;
+			uint32_t storedSize = 0;
+			std::memcpy(&rawSize, header + 1, sizeof(uint32_t));
+			std::memcpy(&storedSize, header + 1 + sizeof(uint32_t), sizeof(uint32_t));
+			const ChunkKind kind = ChunkKind(header[0]);
+			if (kind == ChunkKind::Samples && offset < _fromOffset)
+			{
+				in.seekg(storedSize, std::ios::cur); // read before, the chunk is whole
+				offset += s_headerSize + storedSize;
+				continue;
+			}
+			stored.resize(storedSize);
+			if (!in.read(stored.data(), storedSize))
+			{
+				break;
+			}
+
+			if (kind == ChunkKind::Channel)
+			{
+				if (stored.empty() || uint8_t(stored[0]) > uint8_t(ValueType::Vec3d))
+				{
+					break; // not written by TimeSampleCaptureLog
+				}
+				channels.push_back({ pxr::SdfPath(std::string(stored.begin() + 1, stored.end())), ValueType(stored[0]), {} });
+				offset += s_headerSize + storedSize;
+				continue;
+			}
+			raw.resize(rawSize);
+			if (kind != ChunkKind::Samples || rawSize > pxr::TfFastCompression::GetMaxInputSize() ||
+				pxr::TfFastCompression::DecompressFromBuffer(stored.data(), raw.data(), storedSize, rawSize) != rawSize)
+			{
+				break; // not written by TimeSampleCaptureLog
+			}
+			const char* end = raw.data() + raw.size();
+			const char* record = raw.data();
+			while (end - record >= std::ptrdiff_t(sizeof(uint32_t) + sizeof(double)))
+			{
+				uint32_t channel = 0;
+				double time = 0.0;
+				std::memcpy(&channel, record, sizeof(uint32_t));
+				std::memcpy(&time, record + sizeof(uint32_t), sizeof(double));
+				if (channel >= channels.size() || end - record < std::ptrdiff_t(RecordSize(channels[channel].type)))
+				{
+					break;
+				}
+				const char* value = record + sizeof(uint32_t) + sizeof(double);
+				channels[channel].samples[time] = ReadValue(channels[channel].type, value);
+				record += RecordSize(channels[channel].type);
+				++sampleCount;
+			}
+			if (record != end)
+			{
+				break; // a truncated record, not written by TimeSampleCaptureLog
+			}
+			offset += s_headerSize + storedSize;
+		}
 
-		left = UsdGeom.Xform.Define(stage, '/Left')
-		left_top = UsdGeom.Xform.Define(stage, '/Left/Top')
-		left_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top')
+		pxr::SdfLayerRefPtr layer = pxr::SdfLayer::CreateAnonymous(".usda");
+		{
+			pxr::SdfChangeBlock changes;
+			for (const Channel& channel : channels)
+			{
+				if (channel.samples.empty() || !channel.path.IsPrimPropertyPath())
+				{
+					continue;
+				}
+				pxr::SdfPrimSpecHandle prim = pxr::SdfCreatePrimInLayer(layer, channel.path.GetPrimPath());
+				pxr::SdfAttributeSpecHandle attribute = layer->GetAttributeAtPath(channel.path);
+				if (!attribute)
+				{
+					attribute = pxr::SdfAttributeSpec::New(prim, channel.path.GetName(), TypeName(channel.type));
+				}
+				layer->SetField(channel.path, pxr::SdfFieldKeys->TimeSamples, pxr::VtValue(channel.samples));
+			}
+		}
+		if (_endOffset)
+		{
+			*_endOffset = offset;
+		}
+		if (_sampleCount)
+		{
+			*_sampleCount = sampleCount;
+		}
+		return layer;
+	}
 
-		middle = UsdGeom.Xform.Define(stage, '/Middle')
-		middle.AddTranslateOp().Set(value=(2, 0, 0))
-		middle_top = UsdGeom.Xform.Define(stage, '/Middle/Top')
-		middle_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top', layerOffset = Sdf.LayerOffset(offset=96))
+private:
+	enum class ChunkKind : uint8_t { Channel, Samples };
 
-		right = UsdGeom.Xform.Define(stage, '/Right')
-		right.AddTranslateOp().Set(value=(4, 0, 0))
-		right_top = UsdGeom.Xform.Define(stage, '/Right/Top')
-		right_top.GetPrim().GetReferences().AddReference(assetPath = anim_layer_path, primPath = '/Top', layerOffset = Sdf.LayerOffset(scale=0.25))
+	static constexpr char s_magic[8] = { 'U', 'S', 'D', 'C', 'A', 'P', '0', '1' };
+	static constexpr size_t s_headerSize = 1 + 2 * sizeof(uint32_t);
 
-		stage.Save()
-		print(stage.GetRootLayer().ExportToString())
-	*/
+	static ValueType TypeOf(float) { return ValueType::Float; }
+	static ValueType TypeOf(double) { return ValueType::Double; }
+	static ValueType TypeOf(const pxr::GfVec3f&) { return ValueType::Vec3f; }
+	static ValueType TypeOf(const pxr::GfVec3d&) { return ValueType::Vec3d; }
 
-	// Write the C++ equivalent of the python code above
-	std::string anim_layer_path = "./Step5.usda";
+	static size_t ValueSize(ValueType _type)
+	{
+		switch (_type)
+		{
+		case ValueType::Float: return sizeof(float);
+		case ValueType::Double: return sizeof(double);
+		case ValueType::Vec3f: return sizeof(pxr::GfVec3f);
+		default: return sizeof(pxr::GfVec3d);
+		}
+	}
 
-	path = "Step6.usda";
-	stage = MakeInitialStage(path);
-	stage->SetMetadata(pxr::TfToken("comment"), "Step 6: Layer offsets and animation");
+	static size_t RecordSize(ValueType _type)
+	{
+		return sizeof(uint32_t) + sizeof(double) + ValueSize(_type);
+	}
 
-	pxr::UsdGeomXform left = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Left"));
-	pxr::UsdGeomXform left_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Left/Top"));
-	left_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"));
+	static const pxr::SdfValueTypeName& TypeName(ValueType _type)
+	{
+		switch (_type)
+		{
+		case ValueType::Float: return pxr::SdfValueTypeNames->Float;
+		case ValueType::Double: return pxr::SdfValueTypeNames->Double;
+		case ValueType::Vec3f: return pxr::SdfValueTypeNames->Float3;
+		default: return pxr::SdfValueTypeNames->Double3;
+		}
+	}
 
-	pxr::UsdGeomXform middle = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Middle"));
-	middle.AddTranslateOp().Set(pxr::GfVec3d(2, 0, 0));
-	pxr::UsdGeomXform middle_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Middle/Top"));
-	middle_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"), pxr::SdfLayerOffset(96.));
+	template<class T>
+	static pxr::VtValue ReadValue(const char* _data)
+	{
+		T value;
+		std::memcpy(&value, _data, sizeof(T));
+		return pxr::VtValue(value);
+	}
 
-	pxr::UsdGeomXform right = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Right"));
-	right.AddTranslateOp().Set(pxr::GfVec3d(4, 0, 0));
-	pxr::UsdGeomXform right_top = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Right/Top"));
-	right_top.GetPrim().GetReferences().AddReference(anim_layer_path, pxr::SdfPath("/Top"), pxr::SdfLayerOffset(0.0, 0.25));
+	static pxr::VtValue ReadValue(ValueType _type, const char* _data)
+	{
+		switch (_type)
+		{
+		case ValueType::Float: return ReadValue<float>(_data);
+		case ValueType::Double: return ReadValue<double>(_data);
+		case ValueType::Vec3f: return ReadValue<pxr::GfVec3f>(_data);
+		default: return ReadValue<pxr::GfVec3d>(_data);
+		}
+	}
 
-	stage->GetRootLayer()->Save();
+	bool WriteChunk(ChunkKind _kind, const char* _data, size_t _rawSize, size_t _storedSize)
+	{
+		char header[s_headerSize];
+		header[0] = char(_kind);
+		uint32_t rawSize = uint32_t(_rawSize);
+		uint32_t storedSize = uint32_t(_storedSize);
+		std::memcpy(header + 1, &rawSize, sizeof(uint32_t));
+		std::memcpy(header + 1 + sizeof(uint32_t), &storedSize, sizeof(uint32_t));
+
+		// one write per chunk, a reader never sees a header without its data unless the write is in progress
+		m_chunk.assign(header, header + sizeof(header));
+		m_chunk.insert(m_chunk.end(), _data, _data + _storedSize);
+		m_out.write(m_chunk.data(), m_chunk.size());
+		m_out.flush();
+		if (!m_out)
+		{
+			return false;
+		}
+		m_offset += m_chunk.size();
+		return true;
+	}
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file Step6.usda:\n" << fileResult << std::endl;
-}
+	std::string m_path;
+	size_t m_chunkSize;
+	std::ofstream m_out;
+	uint64_t m_offset = 0;
+	uint64_t m_segmentOffset = 0;
+	std::vector<ValueType> m_channels;
+	std::vector<char> m_samples;
+	std::vector<char> m_compressed;
+	std::vector<char> m_chunk;
+	size_t m_sampleCount = 0;
+};
 
-void TestFunction_PixarTutorial_SimpleShading()
+/*!
+@brief Records the spin and the offset of many tops, as AddSpin and AddOffset author them, at a high rate.
+@details Compares with authoring the same samples with UsdAttribute::Set, and converts the log into crate segments while recording.
+*/
+void TestFunction_TimeSampleCapture()
 {
-	std::cout << "** TestFunction_PixarTutorial_SimpleShading **" << std::endl;
+	std::cout << "** TestFunction_TimeSampleCapture **" << std::endl;
 
-	// -- Step 1
-	std::cout << "---- Step 1 ; Making a Model ----" << std::endl;
+	const int tops = 1000;
+	const int frames = 1000;
+	const int framesPerSegment = 250;
 
-	/*! Python code from the tutorial
-		stage = Usd.Stage.CreateNew("simpleShading.usd")
-		UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.y)
-		
-		modelRoot = UsdGeom.Xform.Define(stage, "/TexModel")
-		Usd.ModelAPI(modelRoot).SetKind(Kind.Tokens.component)
+	// the same samples, through the attributes of a stage
+	{
+		pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateInMemory();
+		std::vector<pxr::UsdAttribute> spins;
+		for (int top = 0; top < 100; ++top)
+		{
+			pxr::UsdGeomXform geom = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/Top_" + std::to_string(top)));
+			spins.push_back(geom.AddRotateZOp(pxr::UsdGeomXformOp::PrecisionFloat, _authoringTokens->spin).GetAttr());
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (int frame = 1; frame <= 100; ++frame)
+		{
+			for (pxr::UsdAttribute& spin : spins)
+			{
+				spin.Set(float(frame) * 1.44f, pxr::UsdTimeCode(frame));
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "UsdAttribute::Set: " << spins.size() * 100 / seconds << " samples/s" << std::endl;
+	}
 
-		print(stage.GetRootLayer().ExportToString())
-	*/
+	const pxr::TfToken spinName = pxr::UsdGeomXformOp::GetOpName(pxr::UsdGeomXformOp::TypeRotateZ, _authoringTokens->spin);
+	const pxr::TfToken offsetName = pxr::UsdGeomXformOp::GetOpName(pxr::UsdGeomXformOp::TypeTranslate, _authoringTokens->offset);
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateNew("simpleShading.usd");
-	pxr::UsdGeomSetStageUpAxis(stage, pxr::UsdGeomTokens->y);
+	TimeSampleCaptureLog capture("Capture.samples");
+	std::vector<uint32_t> spins;
+	std::vector<uint32_t> offsets;
+	for (int top = 0; top < tops; ++top)
+	{
+		pxr::SdfPath path("/Top_" + std::to_string(top));
+		spins.push_back(capture.AddChannel(path.AppendProperty(spinName), TimeSampleCaptureLog::ValueType::Float));
+		offsets.push_back(capture.AddChannel(path.AppendProperty(offsetName), TimeSampleCaptureLog::ValueType::Vec3f));
+	}
 
-	pxr::UsdGeomXform modelRoot = pxr::UsdGeomXform::Define(stage, pxr::SdfPath("/TexModel"));
-	pxr::UsdModelAPI(modelRoot).SetKind(pxr::TfToken("component"));
+	double recordSeconds = 0.0;
+	int segments = 0;
+	for (int frame = 1; frame <= frames; ++frame)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int top = 0; top < tops; ++top)
+		{
+			capture.Append(spins[top], frame, float(frame + top) * 1.44f);
+			capture.Append(offsets[top], frame, pxr::GfVec3f(0.0f, 0.0f, std::sin(frame * 0.01f + top)));
+		}
+		recordSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-	std::string fileResult;
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file simpleShading.usd:\n" << fileResult << std::endl;
+		if (frame % framesPerSegment == 0)
+		{
+			std::string segment = "CaptureSegment" + std::to_string(++segments) + ".usdc";
+			std::cout << "Frame " << frame << ": " << (capture.ExportSegment(segment) ? "converted into " : "FAILED to convert into ") << segment << std::endl;
+		}
+	}
+	if (!capture.Flush())
+	{
+		std::cout << "FAILED to write Capture.samples" << std::endl;
+	}
+	std::cout << capture.GetSampleCount() << " samples recorded at " << capture.GetSampleCount() / recordSeconds << " samples/s" << std::endl;
 
-	// -- Step 2
-	std::cout << "---- Step 2 ; Adding a Mesh “Billboard” ----" << std::endl;
+	size_t samplesRead = 0;
+	pxr::SdfLayerRefPtr layer = TimeSampleCaptureLog::Read("Capture.samples", 0, nullptr, &samplesRead);
+	std::cout << samplesRead << " samples read from Capture.samples, " << (layer ? layer->GetNumTimeSamplesForPath(
+		pxr::SdfPath("/Top_0").AppendProperty(spinName)) : 0) << " of them for /Top_0." << spinName << std::endl;
+}
 
-	/*! Python code from the tutorial
-		billboard = UsdGeom.Mesh.Define(stage, "/TexModel/card")
-		billboard.CreatePointsAttr([(-430, -145, 0), (430, -145, 0), (430, 145, 0), (-430, 145, 0)])
-		billboard.CreateFaceVertexCountsAttr([4])
-		billboard.CreateFaceVertexIndicesAttr([0,1,2,3])
-		billboard.CreateExtentAttr([(-430, -145, 0), (430, 145, 0)])
-		texCoords = UsdGeom.PrimvarsAPI(billboard).CreatePrimvar("st",
-		                                    Sdf.ValueTypeNames.TexCoord2fArray,
-		                                    UsdGeom.Tokens.varying)
-		texCoords.Set([(0, 0), (1, 0), (1,1), (0, 1)])
-		
-		stage.Save()
-		print(stage.GetRootLayer().ExportToString())
-	*/
+/*!
+@brief Shares one buffer between all the equal array values, found by their content.
+@details An array given to Intern() is hashed, and if an equal array was interned before, that
+		 array is returned instead, sharing its buffer copy-on-write: the duplicate is freed
+		 when the last copy of it goes away. Arrays are interned when they are authored, by
+		 Set(), or before a layer is saved, by Deduplicate(), which rewrites the default values
+		 and time samples of the attribute specs with the interned arrays. Only the arrays of
+		 numbers, vectors, quaternions and matrices are interned, the others, e.g. tokens or
+		 strings, are left as they are.
+		 In a file, the crate writer already writes every distinct value once and refers to it
+		 for each of its uses, the store brings the same to the layers in memory.
+		 The store holds a copy of every interned array, Clear() releases them.
+*/
+class ArrayValueStore
+{
+public:
+	struct Statistics
+	{
+		size_t uniqueArrays = 0;
+		size_t uniqueBytes = 0;
+		size_t duplicateArrays = 0;
+		size_t bytesSaved = 0;
+	};
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdGeomMesh billboard = pxr::UsdGeomMesh::Define(stage, pxr::SdfPath("/TexModel/card"));
-	billboard.CreatePointsAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, -145, 0), pxr::GfVec3f(430, 145, 0), pxr::GfVec3f(-430, 145, 0) }));
-	billboard.CreateFaceVertexCountsAttr().Set(pxr::VtIntArray({ 4 }));
-	billboard.CreateFaceVertexIndicesAttr().Set(pxr::VtIntArray({ 0, 1, 2, 3 }));
-	billboard.CreateExtentAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, 145, 0) }));
-	pxr::UsdGeomPrimvar texCoords = pxr::UsdGeomPrimvarsAPI(billboard).CreatePrimvar(pxr::TfToken("st"),
-		pxr::SdfValueTypeNames->TexCoord2fArray,
-		pxr::UsdGeomTokens->varying);
-	texCoords.Set(pxr::VtVec2fArray({ pxr::GfVec2f(0, 0), pxr::GfVec2f(1, 0), pxr::GfVec2f(1, 1), pxr::GfVec2f(0, 1) }));
+	/*!
+	@return The interned value equal to _value, _value itself if it is the first of its kind, or not an array of a
+			type known by GetBuffer(), i.e. numbers, vectors, quaternions and matrices.
+	@param _duplicate set to true if an equal array with a buffer of its own was interned before,
+		   false if _value already shares the buffer of the interned array
+	*/
+	pxr::VtValue Intern(const pxr::VtValue& _value, bool* _duplicate = nullptr)
+	{
+		if (_duplicate)
+		{
+			*_duplicate = false;
+		}
+		const Buffer buffer = GetBuffer(_value);
+		if (!buffer.data)
+		{
+			return _value; // only the arrays whose buffer can be told shared are interned
+		}
 
-	stage->Save();
+		const size_t hash = _value.GetHash();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto equal = m_values.equal_range(hash);
+		for (auto interned = equal.first; interned != equal.second; ++interned)
+		{
+			if (interned->second == _value)
+			{
+				if (buffer.data == GetBuffer(interned->second).data)
+				{
+					return interned->second; // interned already
+				}
+				++m_statistics.duplicateArrays;
+				m_statistics.bytesSaved += buffer.bytes;
+				if (_duplicate)
+				{
+					*_duplicate = true;
+				}
+				return interned->second;
+			}
+		}
+		m_values.emplace(hash, _value);
+		++m_statistics.uniqueArrays;
+		m_statistics.uniqueBytes += buffer.bytes;
+		return _value;
+	}
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file simpleShading.usd after adding a card mesh to the TexModel:\n" << fileResult << std::endl;
+	template<class T>
+	pxr::VtArray<T> Intern(const pxr::VtArray<T>& _array)
+	{
+		return Intern(pxr::VtValue(_array)).template UncheckedGet<pxr::VtArray<T>>();
+	}
 
-	// -- Step 3
-	std::cout << "---- Step 3 ; Make a Material ----" << std::endl;
+	//! Authors the interned array equal to _value.
+	template<class T>
+	bool Set(const pxr::UsdAttribute& _attribute, const pxr::VtArray<T>& _value, pxr::UsdTimeCode _time = pxr::UsdTimeCode::Default())
+	{
+		return _attribute.Set(Intern(_value), _time);
+	}
 
-	/*! Python code from the tutorial
-		material = UsdShade.Material.Define(stage, '/TexModel/boardMat')	
+	/*!
+	@brief Replaces the arrays of the attribute specs of the layer by the interned ones.
+	@return The number of values replaced.
 	*/
+	size_t Deduplicate(const pxr::SdfLayerHandle& _layer)
+	{
+		const std::vector<pxr::SdfPath> attributes = GetAttributes(_layer);
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdShadeMaterial material = pxr::UsdShadeMaterial::Define(stage, pxr::SdfPath("/TexModel/boardMat"));
-
-	// -- Step 4
-	std::cout << "---- Step 4 ; Add a UsdPreviewSurface ----" << std::endl;
-
-	/*! Python code from the tutorial
-		pbrShader = UsdShade.Shader.Define(stage, '/TexModel/boardMat/PBRShader')
-		pbrShader.CreateIdAttr("UsdPreviewSurface")
-		pbrShader.CreateInput("roughness", Sdf.ValueTypeNames.Float).Set(0.4)
-		pbrShader.CreateInput("metallic", Sdf.ValueTypeNames.Float).Set(0.0)
-		
-		material.CreateSurfaceOutput().ConnectToSource(pbrShader.ConnectableAPI(), "surface")
+		// setting a value equal to the current one may be skipped by the layer, so the duplicate is erased first
+		size_t replaced = 0;
+		pxr::SdfChangeBlock changes;
+		for (const pxr::SdfPath& path : attributes)
+		{
+			bool duplicate = false;
+			pxr::VtValue value = Intern(_layer->GetField(path, pxr::SdfFieldKeys->Default), &duplicate);
+			if (duplicate)
+			{
+				_layer->EraseField(path, pxr::SdfFieldKeys->Default);
+				_layer->SetField(path, pxr::SdfFieldKeys->Default, value);
+				++replaced;
+			}
+
+			pxr::VtValue samples = _layer->GetField(path, pxr::SdfFieldKeys->TimeSamples);
+			if (!samples.IsHolding<pxr::SdfTimeSampleMap>())
+			{
+				continue;
+			}
+			pxr::SdfTimeSampleMap interned = samples.UncheckedGet<pxr::SdfTimeSampleMap>();
+			size_t replacedSamples = 0;
+			for (auto& timeAndValue : interned)
+			{
+				timeAndValue.second = Intern(timeAndValue.second, &duplicate);
+				replacedSamples += duplicate ? 1 : 0;
+			}
+			if (replacedSamples > 0)
+			{
+				_layer->EraseField(path, pxr::SdfFieldKeys->TimeSamples);
+				_layer->SetField(path, pxr::SdfFieldKeys->TimeSamples, pxr::VtValue(interned));
+				replaced += replacedSamples;
+			}
+		}
+		return replaced;
+	}
 
-		print(stage.GetRootLayer().ExportToString())
+	/*!
+	@brief Returns the size of the array buffers held by the default values and time samples of the layer.
+	@details A buffer shared by several values is counted once.
 	*/
+	static size_t GetArrayBytes(const pxr::SdfLayerHandle& _layer)
+	{
+		std::set<const void*> buffers;
+		size_t bytes = 0;
+		auto add = [&](const pxr::VtValue& _value)
+		{
+			Buffer buffer = GetBuffer(_value);
+			if (buffer.data && buffers.insert(buffer.data).second)
+			{
+				bytes += buffer.bytes;
+			}
+		};
+		for (const pxr::SdfPath& path : GetAttributes(_layer))
+		{
+			add(_layer->GetField(path, pxr::SdfFieldKeys->Default));
+			pxr::VtValue samples = _layer->GetField(path, pxr::SdfFieldKeys->TimeSamples);
+			if (samples.IsHolding<pxr::SdfTimeSampleMap>())
+			{
+				for (const auto& timeAndValue : samples.UncheckedGet<pxr::SdfTimeSampleMap>())
+				{
+					add(timeAndValue.second);
+				}
+			}
+		}
+		return bytes;
+	}
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdShadeShader pbrShader = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/PBRShader"));
-	pbrShader.CreateIdAttr().Set(pxr::TfToken("UsdPreviewSurface"));
-	pbrShader.CreateInput(pxr::TfToken("roughness"), pxr::SdfValueTypeNames->Float).Set(0.4f);
-	pbrShader.CreateInput(pxr::TfToken("metallic"), pxr::SdfValueTypeNames->Float).Set(0.0f);
+	Statistics GetStatistics() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_statistics;
+	}
 
-	material.CreateSurfaceOutput().ConnectToSource(pbrShader.ConnectableAPI(), pxr::TfToken("surface"));
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_values.clear();
+		m_statistics = Statistics();
+	}
 
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file simpleShading.usd after adding a PBRShader shader to the boardMat:\n" << fileResult << std::endl;
+private:
+	struct Buffer
+	{
+		const void* data = nullptr;
+		size_t bytes = 0;
+	};
 
-	// -- Step 5
-	std::cout << "---- Step 5 ; Add Texturing ----" << std::endl;
+	template<class T>
+	static bool GetBuffer(const pxr::VtValue& _value, Buffer* _buffer)
+	{
+		if (!_value.IsHolding<pxr::VtArray<T>>())
+		{
+			return false;
+		}
+		const pxr::VtArray<T>& array = _value.UncheckedGet<pxr::VtArray<T>>();
+		_buffer->data = array.cdata();
+		_buffer->bytes = array.size() * sizeof(T);
+		return true;
+	}
 
-	/*! Python code from the Tutorial
-		stReader = UsdShade.Shader.Define(stage, '/TexModel/boardMat/stReader')
-		stReader.CreateIdAttr('UsdPrimvarReader_float2')
-		
-		diffuseTextureSampler = UsdShade.Shader.Define(stage,'/TexModel/boardMat/diffuseTexture')
-		diffuseTextureSampler.CreateIdAttr('UsdUVTexture')
-		diffuseTextureSampler.CreateInput('file', Sdf.ValueTypeNames.Asset).Set("USDLogoLrg.png")
-		diffuseTextureSampler.CreateInput("st", Sdf.ValueTypeNames.Float2).ConnectToSource(stReader.ConnectableAPI(), 'result')
-		diffuseTextureSampler.CreateOutput('rgb', Sdf.ValueTypeNames.Float3)
-		pbrShader.CreateInput("diffuseColor", Sdf.ValueTypeNames.Color3f).ConnectToSource(diffuseTextureSampler.ConnectableAPI(), 'rgb')
-		
-		stInput = material.CreateInput('frame:stPrimvarName', Sdf.ValueTypeNames.Token)
-		stInput.Set('st')
-		
-		stReader.CreateInput('varname',Sdf.ValueTypeNames.Token).ConnectToSource(stInput)
-		
-		billboard.GetPrim().ApplyAPI(UsdShade.MaterialBindingAPI)
-		UsdShade.MaterialBindingAPI(billboard).Bind(material)
-		
-		stage.Save()
-	*/
+	//! The elements of the array, for the array types of geometry, primvars and transforms, none for the others and empty arrays.
+	static Buffer GetBuffer(const pxr::VtValue& _value)
+	{
+		Buffer buffer;
+		GetBuffer<int>(_value, &buffer) || GetBuffer<float>(_value, &buffer) || GetBuffer<double>(_value, &buffer)
+			|| GetBuffer<pxr::GfHalf>(_value, &buffer) || GetBuffer<pxr::GfVec2f>(_value, &buffer) || GetBuffer<pxr::GfVec2d>(_value, &buffer)
+			|| GetBuffer<pxr::GfVec3f>(_value, &buffer) || GetBuffer<pxr::GfVec3d>(_value, &buffer) || GetBuffer<pxr::GfVec4f>(_value, &buffer)
+			|| GetBuffer<pxr::GfVec4d>(_value, &buffer) || GetBuffer<pxr::GfQuatf>(_value, &buffer) || GetBuffer<pxr::GfQuatd>(_value, &buffer)
+			|| GetBuffer<pxr::GfMatrix3d>(_value, &buffer) || GetBuffer<pxr::GfMatrix4d>(_value, &buffer);
+		return buffer;
+	}
 
-	// Write the C++ equivalent of the python code above
-	pxr::UsdShadeShader stReader = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/stReader"));
-	stReader.CreateIdAttr().Set(pxr::TfToken("UsdPrimvarReader_float2"));
+	static std::vector<pxr::SdfPath> GetAttributes(const pxr::SdfLayerHandle& _layer)
+	{
+		std::vector<pxr::SdfPath> attributes;
+		_layer->Traverse(pxr::SdfPath::AbsoluteRootPath(), [&](const pxr::SdfPath& _path)
+		{
+			if (_path.IsPropertyPath() && _layer->GetAttributeAtPath(_path))
+			{
+				attributes.push_back(_path);
+			}
+		});
+		return attributes;
+	}
 
-	pxr::UsdShadeShader diffuseTextureSampler = pxr::UsdShadeShader::Define(stage, pxr::SdfPath("/TexModel/boardMat/diffuseTexture"));
-	diffuseTextureSampler.CreateIdAttr().Set(pxr::TfToken("UsdUVTexture"));
-	diffuseTextureSampler.CreateInput(pxr::TfToken("file"), pxr::SdfValueTypeNames->Asset).Set(pxr::SdfAssetPath("./extras/USDLogoLrg.png"));
-	diffuseTextureSampler.CreateInput(pxr::TfToken("st"), pxr::SdfValueTypeNames->Float2).ConnectToSource(stReader.ConnectableAPI(), pxr::TfToken("result"));
-	diffuseTextureSampler.CreateOutput(pxr::TfToken("rgb"), pxr::SdfValueTypeNames->Float3);
-	pbrShader.CreateInput(pxr::TfToken("diffuseColor"), pxr::SdfValueTypeNames->Color3f).ConnectToSource(diffuseTextureSampler.ConnectableAPI(), pxr::TfToken("rgb"));
-	
-	pxr::UsdAttribute stInput = material.CreateInput(pxr::TfToken("frame:stPrimvarName"), pxr::SdfValueTypeNames->Token);
-	stInput.Set(pxr::TfToken("st"));
+	mutable std::mutex m_mutex;
+	std::unordered_multimap<size_t, pxr::VtValue> m_values;
+	Statistics m_statistics;
+};
 
-	stReader.CreateInput(pxr::TfToken("varname"), pxr::SdfValueTypeNames->Token).ConnectToSource(stInput.GetPath());
+/*!
+@brief Kit-bashes many copies of the billboard of SimpleShading and of the sphere of HelloWorld, then deduplicates their arrays.
+*/
+void TestFunction_ArrayDeduplication()
+{
+	std::cout << "** TestFunction_ArrayDeduplication **" << std::endl;
 
-	billboard.GetPrim().ApplyAPI(pxr::TfToken("MaterialBindingAPI"));//note: the plugin usdShade MUST be loaded
-	pxr::UsdShadeMaterialBindingAPI(billboard).Bind(material);
+	const int copies = 2000;
+	pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateInMemory();
+	for (int copy = 0; copy < copies; ++copy)
+	{
+		// every copy gets arrays of its own, as when they come from different sources
+		std::string name = std::to_string(copy);
+		pxr::UsdGeomMesh billboard = pxr::UsdGeomMesh::Define(stage, pxr::SdfPath("/Billboard_" + name));
+		billboard.CreatePointsAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, -145, 0), pxr::GfVec3f(430, 145, 0), pxr::GfVec3f(-430, 145, 0) }));
+		billboard.CreateFaceVertexCountsAttr().Set(pxr::VtIntArray({ 4 }));
+		billboard.CreateFaceVertexIndicesAttr().Set(pxr::VtIntArray({ 0, 1, 2, 3 }));
+		billboard.CreateExtentAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-430, -145, 0), pxr::GfVec3f(430, 145, 0) }));
+		pxr::UsdGeomPrimvar texCoords = pxr::UsdGeomPrimvarsAPI(billboard).CreatePrimvar(_authoringTokens->st,
+			pxr::SdfValueTypeNames->TexCoord2fArray, pxr::UsdGeomTokens->varying);
+		texCoords.Set(pxr::VtVec2fArray({ pxr::GfVec2f(0, 0), pxr::GfVec2f(1, 0), pxr::GfVec2f(1, 1), pxr::GfVec2f(0, 1) }));
+
+		pxr::UsdGeomSphere sphere = pxr::UsdGeomSphere::Define(stage, pxr::SdfPath("/Sphere_" + name));
+		sphere.CreateExtentAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(-2), pxr::GfVec3f(2) }));
+		sphere.CreateDisplayColorAttr().Set(pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) }));
+	}
 
-	stage->Save();
-	stage->GetRootLayer()->ExportToString(&fileResult);
-	std::cout << "Content of file simpleShading.usd after adding texturing to the boardMat:\n" << fileResult << std::endl;
+	ArrayValueStore store;
+	size_t bytesBefore = ArrayValueStore::GetArrayBytes(stage->GetRootLayer());
+	auto start = std::chrono::steady_clock::now();
+	size_t replaced = store.Deduplicate(stage->GetRootLayer());
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	ArrayValueStore::Statistics statistics = store.GetStatistics();
+	std::cout << replaced << " arrays replaced in " << seconds << " s: " << statistics.uniqueArrays << " unique arrays of "
+		<< statistics.uniqueBytes << " bytes, " << statistics.bytesSaved << " bytes saved" << std::endl;
+	std::cout << "Arrays of the layer: " << bytesBefore << " bytes before, " << ArrayValueStore::GetArrayBytes(stage->GetRootLayer())
+		<< " bytes after deduplicating" << std::endl;
+
+	// deduplicating again finds the arrays interned already, and leaves the layer as it is
+	std::cout << store.Deduplicate(stage->GetRootLayer()) << " arrays replaced when deduplicating again" << std::endl;
+
+	// interned when authored, the duplicates are never allocated for long
+	store.Clear();
+	pxr::UsdStageRefPtr authored = pxr::UsdStage::CreateInMemory();
+	for (int copy = 0; copy < copies; ++copy)
+	{
+		pxr::UsdGeomSphere sphere = pxr::UsdGeomSphere::Define(authored, pxr::SdfPath("/Sphere_" + std::to_string(copy)));
+		store.Set(sphere.CreateExtentAttr(), pxr::VtVec3fArray({ pxr::GfVec3f(-2), pxr::GfVec3f(2) }));
+		store.Set(sphere.CreateDisplayColorAttr(), pxr::VtVec3fArray({ pxr::GfVec3f(0, 0, 1) }));
+	}
+	statistics = store.GetStatistics();
+	std::cout << "Interned while authoring: " << statistics.uniqueArrays << " unique arrays, " << statistics.duplicateArrays
+		<< " duplicates, " << statistics.bytesSaved << " bytes saved" << std::endl;
 }
 
-int main()
+int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[])
 {
+#ifdef __linux__
+	// The worker processes started by TestFunction_SharedLayerCache run this same executable.
+	if (argc == 4 && std::string(argv[1]) == "--shared-layer-cache-worker")
+	{
+		return RunSharedLayerCacheWorker(argv[2], argv[3]);
+	}
+#endif
 
 	TestFunction_StageCreation();
 
@@ -1036,6 +5655,26 @@ int main()
 
 	TestFunction_PixarTutorial_SimpleShading();
 
+	TestFunction_PrefetchingCrateOpen();
+
+	TestFunction_SharedLayerCache();
+
+	TestFunction_BulkAuthoringBenchmark();
+
+	TestFunction_MeshPacking();
+
+	TestFunction_MeshDerivatives();
+
+	TestFunction_AsyncStageOpen();
+
+	TestFunction_CompositionProfile();
+
+	TestFunction_SceneDiff();
+
+	TestFunction_TimeSampleCapture();
+
+	TestFunction_ArrayDeduplication();
+
 	std::cout << "End of main." << std::endl;
 
 	return 0;